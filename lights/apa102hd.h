@@ -0,0 +1,132 @@
+#ifndef APA102HD_H
+#define APA102HD_H
+
+#include <FastLED.h>
+#include <SPI.h>
+#include "util.h"
+
+// Output stage that uses the APA102's 5-bit per-pixel brightness for low-end resolution, instead of
+// letting the 8-bit global fader throw away the bottom bits of every channel.
+// Each channel goes through a gamma table to 16-bit linear light and is scaled by the global brightness.
+// The pixel's 5-bit brightness is the smallest that holds its brightest channel, and the channels are
+// rescaled to 8.8 fixed point under it; the rounding to 8 bits is dithered over frames so in-between
+// levels average out. All the curves are tables built once in begin(), so per pixel it's lookups,
+// multiplies and shifts. Frames go straight out over SPI, bypassing FastLED.show().
+#define HD_GAMMA 2.8
+#define HD_END_FRAME_BYTES (4 + NUM_LEDS / 16)
+
+// Below this the dither's alternation between neighbouring levels shows as flicker on dim pixels
+const uint16_t kHDDitherMinFramerate = 100;
+
+class APA102HDOutput {
+  private:
+    uint16_t gamma[256];
+    // top byte of the brightest 16-bit channel -> smallest 5-bit brightness that holds it
+    uint8_t globalFor[256];
+    // 5-bit brightness -> 8.8 factor from a 16-bit linear channel to an 8.8 channel value
+    uint16_t scaleFor[32];
+    // bit-reversed counter, so any run of consecutive frames spreads its dither offsets evenly
+    uint8_t dither[256];
+    uint8_t frame = 0;
+    uint8_t buffer[4 + NUM_LEDS * 4 + HD_END_FRAME_BYTES];
+    uint32_t clockHz;
+
+  public:
+    bool dithering = true;
+    unsigned long frames = 0;
+    unsigned long encodeMicros = 0;
+    unsigned long writeMicros = 0;
+
+    APA102HDOutput(uint32_t clockHz) : clockHz(clockHz) { }
+
+    void begin() {
+      for (int i = 0; i < 256; ++i) {
+        gamma[i] = roundf(65535 * powf(i / 255.0, HD_GAMMA));
+        uint32_t worst = (i << 8) | 0xFF;
+        globalFor[i] = max(1, (worst * 31 + 65534) / 65535);
+        uint8_t reversed = 0;
+        for (uint8_t bit = 0; bit < 8; ++bit) {
+          reversed |= ((i >> bit) & 1) << (7 - bit);
+        }
+        dither[i] = reversed;
+      }
+      for (int g = 1; g < 32; ++g) {
+        scaleFor[g] = (31UL * 256 * 256) / (g * 257UL);
+      }
+      memset(buffer, 0, 4);
+      memset(buffer + 4 + NUM_LEDS * 4, 0xFF, HD_END_FRAME_BYTES);
+      SPI.begin();
+    }
+
+    // Encodes leds (BGR on the wire, like the strips' FastLED order) at the given 8-bit brightness
+    void encode(const CRGB *leds, uint16_t count, uint8_t brightness) {
+      uint32_t scale = brightness + 1;
+      uint8_t *out = buffer + 4;
+      for (uint16_t i = 0; i < count; ++i, out += 4) {
+        uint32_t r = (gamma[leds[i].r] * scale) >> 8;
+        uint32_t g = (gamma[leds[i].g] * scale) >> 8;
+        uint32_t b = (gamma[leds[i].b] * scale) >> 8;
+        uint8_t global = globalFor[max(r, max(g, b)) >> 8];
+        uint32_t factor = scaleFor[global];
+        uint32_t offset = dithering ? dither[(uint8_t)(frame + i * 37)] : 0x80;
+        out[0] = 0xE0 | global;
+        out[1] = min(255, ((b * factor >> 8) + offset) >> 8);
+        out[2] = min(255, ((g * factor >> 8) + offset) >> 8);
+        out[3] = min(255, ((r * factor >> 8) + offset) >> 8);
+      }
+      ++frame;
+    }
+
+    void write() {
+      SPI.beginTransaction(SPISettings(clockHz, MSBFIRST, SPI_MODE0));
+      SPI.transfer(buffer, NULL, sizeof(buffer));
+      SPI.endTransaction();
+    }
+
+    void show(const CRGB *leds, uint16_t count, uint8_t brightness) {
+      unsigned long start = micros();
+      encode(leds, count, brightness);
+      unsigned long encoded = micros();
+      write();
+      encodeMicros += encoded - start;
+      writeMicros += micros() - encoded;
+      ++frames;
+    }
+};
+
+// Times the FastLED output path against this one on the same frame, at a low brightness where
+// the difference in resolution matters
+void benchmarkHDOutput(APA102HDOutput &output, CRGB *leds, uint16_t count) {
+  const int kFrames = 200;
+  const uint8_t kBrightness = 12;
+  for (uint16_t i = 0; i < count; ++i) {
+    leds[i] = CRGB(random8(), random8(), random8());
+  }
+  uint8_t savedBrightness = FastLED.getBrightness();
+  FastLED.setBrightness(kBrightness);
+  unsigned long start = micros();
+  for (int i = 0; i < kFrames; ++i) {
+    FastLED.show();
+  }
+  unsigned long fastledMicros = micros() - start;
+  FastLED.setBrightness(savedBrightness);
+
+  start = micros();
+  for (int i = 0; i < kFrames; ++i) {
+    output.encode(leds, count, kBrightness);
+  }
+  unsigned long encodeMicros = micros() - start;
+  start = micros();
+  for (int i = 0; i < kFrames; ++i) {
+    output.show(leds, count, kBrightness);
+  }
+  unsigned long showMicros = micros() - start;
+  output.frames = output.encodeMicros = output.writeMicros = 0;
+  logf("Output stage per frame: FastLED.show() %.1f us, HD encode %.1f us, HD encode + SPI write %.1f us",
+       fastledMicros / (float)kFrames, encodeMicros / (float)kFrames, showMicros / (float)kFrames);
+  for (uint16_t i = 0; i < count; ++i) {
+    leds[i] = CRGB::Black;
+  }
+}
+
+#endif
@@ -0,0 +1,79 @@
+#!/usr/bin/env python3
+# One table of per-pattern costs from the benchmarks a pendant logs at boot.
+#
+#   ./bench_report.py boot.log [--baseline before.log]
+#
+# Cycle counts come from the "cycles" lines CYCLE_BENCHMARK logs (DWT cycle counter, so real Cortex-M4
+# cycles), microseconds from the "bits preset" lines of BITS_BENCHMARK. Budget columns are the share of a
+# frame's cycles at the rate the pattern asks for. With a baseline log, the change in average cycles is shown
+# too. Summary lines from the other benchmarks (palette decode, output stage, VM_BENCHMARK's VM against native) are
+# listed after the table.
+import argparse
+import re
+
+CYCLES = re.compile(r"cycles (\d+) avg (\d+) max (\d+) budget (.*)")
+BITS_MICROS = re.compile(r"bits preset (\d+) ([\d.]+) us/frame (.*)")
+OTHER = ("Palette decode:", "Palette flash:", "Output stage per frame:", "Pattern cycles per frame", "VM port of", "first differing frame")
+
+class Kernel:
+	def __init__(self, name):
+		self.name = name
+		self.cycles = None
+		self.max_cycles = None
+		self.budget = None
+		self.micros = None
+
+def read_log(path):
+	kernels = {}
+	other = []
+	def kernel(name):
+		if name not in kernels:
+			kernels[name] = Kernel(name)
+		return kernels[name]
+	for line in open(path, errors="replace"):
+		line = line.strip()
+		match = CYCLES.match(line)
+		if match:
+			k = kernel(match.group(4))
+			k.cycles, k.max_cycles, k.budget = (int(g) for g in match.groups()[:3])
+			continue
+		match = BITS_MICROS.match(line)
+		if match:
+			kernel("Bits preset {} {}".format(match.group(1), match.group(3))).micros = float(match.group(2))
+			continue
+		if line.startswith(OTHER):
+			other.append(line)
+	return kernels, other
+
+def main():
+	parser = argparse.ArgumentParser()
+	parser.add_argument("log", help="Serial log from a boot with CYCLE_BENCHMARK and/or the other benchmarks set")
+	parser.add_argument("--baseline", help="Earlier log to compare average cycles against")
+	args = parser.parse_args()
+
+	kernels, other = read_log(args.log)
+	baseline = read_log(args.baseline)[0] if args.baseline else {}
+	header = "{:<36} {:>10} {:>10} {:>8} {:>8} {:>10}".format("kernel", "cycles", "max", "budget", "worst", "us/frame")
+	if baseline:
+		header += " {:>8}".format("change")
+	print(header)
+	for k in kernels.values():
+		row = "{:<36} {:>10} {:>10} {:>8} {:>8} {:>10}".format(
+			k.name,
+			k.cycles if k.cycles is not None else "-",
+			k.max_cycles if k.max_cycles is not None else "-",
+			"{:.1f}%".format(100.0 * k.cycles / k.budget) if k.budget else "-",
+			"{:.1f}%".format(100.0 * k.max_cycles / k.budget) if k.budget else "-",
+			"{:.2f}".format(k.micros) if k.micros is not None else "-")
+		if baseline:
+			before = baseline.get(k.name)
+			if before and before.cycles and k.cycles is not None:
+				row += " {:>+7.1f}%".format(100.0 * (k.cycles - before.cycles) / before.cycles)
+			else:
+				row += " {:>8}".format("-")
+		print(row)
+	for line in other:
+		print(line)
+
+if __name__ == "__main__":
+	main()
@@ -0,0 +1,69 @@
+#ifndef BOOT_H
+#define BOOT_H
+
+#include "util.h"
+
+// Start-up work that can wait until the LEDs are lit. With FAST_BOOT, setup() shows a cheap first frame
+// straight after LED init and leaves serial, RNG entropy and the RAM report to these tasks, which run in
+// order, one per frame, in the slack after the LEDs are out (the first pattern's palette preparation rides
+// on the playlist's prewarm the same way, once the RNG is seeded). Once they're done, the times from reset
+// to the first lit frame and to the first frame a pattern drew are logged. Those are micros() since reset,
+// so they include the Teensy core's own start-up before setup() runs.
+typedef void (*BootTask)();
+
+// frames a task waits for slack before it runs anyway
+const uint8_t kBootTaskMaxWaitFrames = 50;
+
+class BootSequence {
+  private:
+    const BootTask *tasks;
+    uint8_t count;
+    uint8_t next = 0;
+    uint8_t waited = 0;
+    uint32_t firstPhotonMicros = 0;
+    uint32_t firstPatternMicros = 0;
+    bool reported = false;
+
+  public:
+    BootSequence(const BootTask *tasks, uint8_t count) : tasks(tasks), count(count) { }
+
+    // Call each time the LEDs are shown, saying whether a pattern drew the frame
+    void frameShown(bool patternFrame) {
+      uint32_t now = micros();
+      if (!firstPhotonMicros) {
+        firstPhotonMicros = now;
+      }
+      if (patternFrame && !firstPatternMicros) {
+        firstPatternMicros = now;
+      }
+      if (!reported && firstPatternMicros && done()) {
+        logf("Boot: first frame lit at %lu us, first pattern frame at %lu us",
+             (unsigned long)firstPhotonMicros, (unsigned long)firstPatternMicros);
+        reported = true;
+      }
+    }
+
+    // Call once a frame, after the LEDs are out, with the time left before the next frame is due
+    void useSlack(int32_t slackMicros) {
+      if (done() || (slackMicros <= 0 && ++waited < kBootTaskMaxWaitFrames)) {
+        return;
+      }
+      waited = 0;
+      tasks[next++]();
+    }
+
+    bool ran(BootTask task) {
+      for (uint8_t i = 0; i < next; ++i) {
+        if (tasks[i] == task) {
+          return true;
+        }
+      }
+      return false;
+    }
+
+    bool done() {
+      return next == count;
+    }
+};
+
+#endif
@@ -0,0 +1,125 @@
+#ifndef BUDGET_H
+#define BUDGET_H
+
+#include "util.h"
+#include "patterns.h"
+
+// Frame budget governor. When the frame's busy time (everything loop() does before it sleeps) keeps going
+// over its share of the frame period, the active pattern and its sub pattern are asked to draw at a lower
+// quality level (Pattern::setQuality()). It only steps back up after a few seconds comfortably under
+// budget, and not while the busy time last seen at the better level would still overrun, so quality
+// doesn't flip back and forth. Those remembered costs are trusted for kBudgetRetryMicros before the
+// better level gets another try. With BUDGET_STATS, time spent at each level is logged every 10 s
+// along with the pattern's update() cost.
+const uint8_t kQualityLevels = 3;
+// the rest of the frame is headroom for serial input and timing jitter
+const float kBudgetShare = 0.9;
+// a level is only left for a better one when running this far under budget
+const float kBudgetRecoverShare = 0.6;
+const uint8_t kBudgetOverrunFrames = 8;
+const uint32_t kBudgetRecoverMicros = 3000000;
+const uint32_t kBudgetRetryMicros = 30000000;
+const uint32_t kBudgetReportMicros = 10000000;
+
+class FrameBudget {
+  private:
+    Pattern *pattern = NULL;
+    uint8_t overruns = 0;
+    bool underBudget = false;
+    uint32_t underSince = 0;
+    uint32_t degradedAt = 0;
+    // smoothed busy time at each level with the current pattern, 0 if not seen yet
+    float costAt[kQualityLevels] = {0};
+    float averageBusy = 0;
+    uint32_t lastFrame = 0;
+    uint32_t reportStart = 0;
+    uint32_t microsAt[kQualityLevels] = {0};
+
+  public:
+    uint8_t level = 0;
+    unsigned long levelChanges = 0;
+
+    // Call once per loop(), with the time spent on the frame and the rate it is meant to run at
+    void frameCompleted(Pattern *active, uint32_t busyMicros, uint16_t framerate) {
+      uint32_t now = micros();
+      if (lastFrame == 0) {
+        reportStart = now;
+      } else {
+        microsAt[level] += now - lastFrame;
+      }
+      lastFrame = now;
+      report(now);
+
+      if (active != pattern) {
+        // costs differ from pattern to pattern, so start again at full quality
+        pattern = active;
+        memset(costAt, 0, sizeof(costAt));
+        setLevel(0, now);
+        return;
+      }
+      if (!pattern) {
+        return;
+      }
+
+      averageBusy = averageBusy == 0 ? busyMicros : averageBusy * 0.9 + busyMicros * 0.1;
+      costAt[level] = averageBusy;
+      uint32_t budget = kBudgetShare * 1000000 / framerate;
+      if (busyMicros > budget) {
+        underBudget = false;
+        if (++overruns >= kBudgetOverrunFrames && level + 1 < kQualityLevels) {
+          setLevel(level + 1, now);
+        }
+        return;
+      }
+      overruns = 0;
+      bool betterFits = level > 0 && (costAt[level - 1] < budget || now - degradedAt > kBudgetRetryMicros);
+      if (!betterFits || averageBusy > kBudgetRecoverShare * budget) {
+        underBudget = false;
+      } else if (!underBudget) {
+        underBudget = true;
+        underSince = now;
+      } else if (now - underSince >= kBudgetRecoverMicros) {
+        setLevel(level - 1, now);
+      }
+    }
+
+  private:
+    void setLevel(uint8_t newLevel, uint32_t now) {
+      if (newLevel > level) {
+        degradedAt = now;
+      }
+      if (newLevel != level) {
+        ++levelChanges;
+#if BUDGET_STATS
+        logf("Frame budget: %s to quality level %u (busy %.0f us)", pattern ? pattern->description() : "none", newLevel, averageBusy);
+#endif
+      }
+      level = newLevel;
+      overruns = 0;
+      underBudget = false;
+      averageBusy = 0;
+      if (pattern) {
+        pattern->setQuality(level);
+      }
+    }
+
+    void report(uint32_t now) {
+      if (now - reportStart < kBudgetReportMicros) {
+        return;
+      }
+#if BUDGET_STATS
+      float total = now - reportStart;
+      logf("Frame budget: level 0 %.1f%%, level 1 %.1f%%, level 2 %.1f%% of the time, %lu changes",
+           100 * microsAt[0] / total, 100 * microsAt[1] / total, 100 * microsAt[2] / total, levelChanges);
+      if (pattern) {
+        logf("  %s update %lu us, sub pattern %lu us", pattern->description(),
+             (unsigned long)pattern->lastUpdateMicros(), (unsigned long)pattern->lastSubPatternMicros());
+      }
+#endif
+      memset(microsAt, 0, sizeof(microsAt));
+      levelChanges = 0;
+      reportStart = now;
+    }
+};
+
+#endif
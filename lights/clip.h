@@ -0,0 +1,135 @@
+#ifndef CLIP_H
+#define CLIP_H
+
+#include <FastLED.h>
+#include "util.h"
+#include "patterns.h"
+
+// Precompiled animation clips: frames of a pattern captured with ClipRecorder, compressed
+// by clip_compiler.py, and played back from flash by ClipPattern.
+//
+// Each frame is a run of ops covering the NUM_LEDS * 3 bytes of the LED buffer, relative to the previous
+// frame (the first frame is relative to black):
+//   0x00-0x7F  skip (op + 1) bytes, unchanged from the previous frame
+//   0x80-0xBF  (op & 0x3F) + 1 literal bytes follow
+//   0xC0-0xFF  the next byte, repeated (op & 0x3F) + 1 times
+
+#define CLIP_OP_SKIP 0x00
+#define CLIP_OP_LITERAL 0x80
+#define CLIP_OP_REPEAT 0xC0
+#define CLIP_OP_COUNT(op) (((op) & ((op) & 0x80 ? 0x3F : 0x7F)) + 1)
+
+typedef struct _Clip {
+  const uint8_t *data;
+  uint32_t length;
+  uint16_t frameCount;
+  uint16_t frameMillis;
+} Clip;
+
+// Decodes one frame worth of ops from data into frame, returning the number of stream bytes consumed
+inline uint32_t decodeClipFrame(const uint8_t *data, uint8_t *frame, uint16_t frameBytes) {
+  const uint8_t *start = data;
+  uint16_t pos = 0;
+  while (pos < frameBytes) {
+    uint8_t op = pgm_read_byte(data++);
+    uint8_t count = CLIP_OP_COUNT(op);
+    if (pos + count > frameBytes) {
+      count = frameBytes - pos;
+    }
+    if ((op & 0x80) == CLIP_OP_SKIP) {
+      pos += count;
+    } else if ((op & 0xC0) == CLIP_OP_LITERAL) {
+      for (uint8_t i = 0; i < count; ++i) {
+        frame[pos++] = pgm_read_byte(data++);
+      }
+    } else {
+      uint8_t value = pgm_read_byte(data++);
+      memset(&frame[pos], value, count);
+      pos += count;
+    }
+  }
+  return data - start;
+}
+
+// Writes one frame as "<prefix> <hex bytes>" over serial, for the host-side capture tools
+void printFrame(const char *prefix, CRGBArray<NUM_LEDS> &leds) {
+  static const char hex[] = "0123456789abcdef";
+  static char line[NUM_LEDS * sizeof(CRGB) * 2 + 1];
+  CRGB *pixels = leds;
+  const uint8_t *bytes = (const uint8_t *)pixels;
+  for (unsigned i = 0; i < NUM_LEDS * sizeof(CRGB); ++i) {
+    line[2 * i] = hex[bytes[i] >> 4];
+    line[2 * i + 1] = hex[bytes[i] & 0xF];
+  }
+  line[sizeof(line) - 1] = '\0';
+  Serial.print(prefix);
+  Serial.print(" ");
+  Serial.println(line);
+}
+
+class ClipPattern : public Pattern {
+  private:
+    const Clip &clip;
+    uint32_t readPos = 0;
+    unsigned long lastFrame = 0;
+    bool restart = true;
+
+    void setup() {
+      readPos = 0;
+      restart = true;
+    }
+
+  public:
+    ClipPattern(const Clip &clip) : clip(clip) { }
+
+    void update(CRGBArray<NUM_LEDS> &leds) {
+      unsigned long mils = gClock.millis();
+      if (!restart && mils - lastFrame < clip.frameMillis) {
+        return;
+      }
+      if (readPos >= clip.length) {
+        readPos = 0;
+        restart = true;
+      }
+      if (restart) {
+        leds.fill_solid(CRGB::Black);
+        restart = false;
+      }
+      CRGB *pixels = leds;
+      readPos += decodeClipFrame(clip.data + readPos, (uint8_t *)pixels, NUM_LEDS * sizeof(CRGB));
+      lastFrame = mils;
+    }
+
+    const char *description() {
+      return "Clip";
+    }
+};
+
+// Dumps frames of a pattern over serial for clip_compiler.py. Like the golden capture it runs from a fixed
+// virtual time and RNG seed with one frame every frameMillis, so the clip is the same however fast the
+// frames can be printed:
+//   clip begin <frameMillis> <frameBytes>
+//   clip frame <hex bytes>
+//   clip end <frameCount>
+#define CLIP_START_MILLIS 1000
+
+void recordClip(Pattern *pattern, CRGBArray<NUM_LEDS> &leds, unsigned int seconds, uint16_t frameMillis, uint16_t seed) {
+  unsigned int frames = seconds * 1000 / frameMillis;
+  gClock.useVirtualTime(CLIP_START_MILLIS);
+  random16_set_seed(seed);
+  randomSeed(seed);
+  leds.fill_solid(CRGB::Black);
+
+  logf("clip begin %u %u", frameMillis, (unsigned)(NUM_LEDS * sizeof(CRGB)));
+  pattern->start();
+  for (unsigned int frame = 0; frame < frames; ++frame) {
+    pattern->loop(leds);
+    printFrame("clip frame", leds);
+    gClock.advance(frameMillis);
+  }
+  pattern->stop();
+  logf("clip end %u", frames);
+  gClock.useRealTime();
+}
+
+#endif
@@ -0,0 +1,108 @@
+#!/usr/bin/env python3
+# Compresses frames captured with CLIP_RECORD into a clip header for ClipPattern.
+#
+# Capture the serial output of a CLIP_RECORD build to a file, then:
+#   ./clip_compiler.py capture.log name
+# writes clip_<name>.h defining `const Clip clip_<name>`. The CLIP_PLAYBACK build includes clip_playback.h
+# and plays it as an idle pattern; ./emu.py clip records and compiles that one on the host. See clip.h
+# for the stream format.
+import argparse
+import os
+
+OP_LITERAL = 0x80
+OP_REPEAT = 0xC0
+MAX_SKIP = 0x80
+MAX_RUN = 0x40
+MIN_REPEAT = 3
+
+def read_capture(path):
+	frame_millis = None
+	frame_bytes = None
+	frames = []
+	for line in open(path):
+		words = line.split()
+		if len(words) < 2 or words[0] != "clip":
+			continue
+		if words[1] == "begin":
+			frame_millis, frame_bytes = int(words[2]), int(words[3])
+			frames = []
+		elif words[1] == "frame" and frame_bytes is not None:
+			frame = bytes.fromhex(words[2])
+			if len(frame) == frame_bytes:
+				frames.append(frame)
+	assert frames, "no clip frames found in {}".format(path)
+	return frame_millis, frame_bytes, frames
+
+def run_length(frame, pos, predicate):
+	end = pos
+	while end < len(frame) and predicate(end):
+		end += 1
+	return end - pos
+
+def encode_frame(prev, frame):
+	ops = bytearray()
+	literal = bytearray()
+
+	def flush_literal():
+		for i in range(0, len(literal), MAX_RUN):
+			chunk = literal[i:i + MAX_RUN]
+			ops.append(OP_LITERAL | (len(chunk) - 1))
+			ops.extend(chunk)
+		del literal[:]
+
+	pos = 0
+	while pos < len(frame):
+		unchanged = run_length(frame, pos, lambda i: frame[i] == prev[i])
+		repeated = run_length(frame, pos, lambda i: frame[i] == frame[pos])
+		# a single unchanged byte is cheaper inside a literal than as its own skip op
+		if unchanged >= 2 or (unchanged and not literal):
+			flush_literal()
+			count = min(unchanged, MAX_SKIP)
+			ops.append(count - 1)
+			pos += count
+		elif repeated >= MIN_REPEAT:
+			flush_literal()
+			count = min(repeated, MAX_RUN)
+			ops.append(OP_REPEAT | (count - 1))
+			ops.append(frame[pos])
+			pos += count
+		else:
+			literal.append(frame[pos])
+			pos += 1
+	flush_literal()
+	return ops
+
+def main():
+	parser = argparse.ArgumentParser()
+	parser.add_argument('capture', help='Serial log containing "clip" lines')
+	parser.add_argument('name', help='Clip name, used for the header and symbol names')
+	parser.add_argument('-o', dest='output', help='Output header (default clip_<name>.h next to this script)')
+	args = parser.parse_args()
+
+	frame_millis, frame_bytes, frames = read_capture(args.capture)
+
+	stream = bytearray()
+	prev = bytes(frame_bytes)
+	for frame in frames:
+		stream.extend(encode_frame(prev, frame))
+		prev = frame
+
+	symbol = "clip_" + args.name
+	output = args.output or os.path.join(os.path.dirname(os.path.realpath(__file__)), symbol + ".h")
+	raw_bytes = frame_bytes * len(frames)
+
+	with open(output, "w") as out:
+		guard = symbol.upper() + "_H"
+		out.write("// Generated by clip_compiler.py from {} -- do not edit.\n".format(os.path.basename(args.capture)))
+		out.write("// {} frames at {} ms, {} bytes ({:.1f}% of {} raw).\n\n".format(len(frames), frame_millis, len(stream), 100.0 * len(stream) / raw_bytes, raw_bytes))
+		out.write("#ifndef {0}\n#define {0}\n\n#include \"clip.h\"\n\n".format(guard))
+		out.write("const uint8_t {}_data[] PROGMEM = {{\n".format(symbol))
+		for i in range(0, len(stream), 16):
+			out.write("  " + ", ".join("0x{:02x}".format(b) for b in stream[i:i + 16]) + ",\n")
+		out.write("};\n\n")
+		out.write("const Clip {0} = {{ {0}_data, sizeof({0}_data), {1}, {2} }};\n\n#endif\n".format(symbol, len(frames), frame_millis))
+
+	print("{} frames, {} bytes raw -> {} bytes ({:.1f}%), {:.1f} bytes/frame".format(len(frames), raw_bytes, len(stream), 100.0 * len(stream) / raw_bytes, len(stream) / float(len(frames))))
+
+if __name__ == "__main__":
+	main()
@@ -0,0 +1,198 @@
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#include "util.h"
+
+// Binary live-control protocol on the Serial port, shared with logf() text output.
+// Frames in both directions are:
+//   0xA5  cmd  len  payload[len]  crc8(cmd, len, payload)
+// Replies echo the command with CONTROL_REPLY set, or are CONTROL_NAK with (cmd, error).
+// Text log lines never contain 0xA5, so a host reader can skip anything that isn't a valid frame.
+// Multi-byte fields are little-endian. See control.py for the host side.
+
+#define CONTROL_SOF 0xA5
+#define CONTROL_MAX_PAYLOAD 64
+#define CONTROL_REPLY 0x80
+// a frame whose bytes stop for longer than this lost one; idle() drops it and the parser looks for 0xA5 again
+#define CONTROL_BYTE_TIMEOUT_MILLIS 50
+
+enum ControlCommand {
+  controlPing = 0x01,          // -> empty reply
+  controlSelectPattern = 0x02, // u8 pattern index, optional i16 variant (-1 random)
+  controlNextPattern = 0x03,   //
+  controlSetBrightness = 0x04, // u8 brightness
+  controlSetParameter = 0x05,  // u8 parameter id, i16 value; applied to the active pattern
+  controlQueryStats = 0x06,    // -> ControlStats
+  controlStreamFrame = 0x07,   // u8 seq, u8 flags, clip ops (see stream.h) -> u8 seq, u16 decode+show micros
+  controlStreamEnd = 0x08,     // leave streaming mode
+  controlLoadProgram = 0x09,   // u8 ControlChunkFlags, the next bytes of a VM program (see vm.h); the last chunk starts it
+  controlNak = 0x7F,
+};
+
+enum ControlChunkFlags {
+  controlChunkFirst = 0x01,
+  controlChunkLast = 0x02,
+};
+
+enum ControlError {
+  controlErrorBadCrc = 1,
+  controlErrorUnknownCommand = 2,
+  controlErrorBadPayload = 3,
+  controlErrorRejected = 4,
+};
+
+typedef struct __attribute__((packed)) _ControlStats {
+  uint32_t uptimeMillis;
+  uint16_t framerateTimes10;
+  uint8_t patternIndex;        // 0xFF while no idle pattern is running
+  int16_t variant;
+  uint8_t brightness;
+  uint16_t scratchInUse;
+  uint16_t scratchHighWater;
+  uint32_t framesReceived;
+  uint32_t framesRejected;
+  uint16_t framerate;
+  uint16_t awakePermille;
+  uint16_t estimatedMilliamps;
+  uint16_t batteryMinutes;
+} ControlStats;
+
+// Receives the payload of a streamed command byte by byte as it arrives, instead of it being buffered
+class ControlStreamSink {
+  public:
+    virtual ~ControlStreamSink() { }
+    virtual void begin() = 0;
+    virtual void feed(uint8_t byte) = 0;
+    // the frame won't be completed: its CRC failed, or it was cut short
+    virtual void reject() = 0;
+};
+
+inline uint8_t crc8Update(uint8_t crc, uint8_t data) {
+  crc ^= data;
+  for (uint8_t bit = 0; bit < 8; ++bit) {
+    crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+  }
+  return crc;
+}
+
+// Incremental frame parser. Holds one frame in a fixed buffer and never allocates.
+class ControlParser {
+  private:
+    enum State {
+      waitSof, readCmd, readLen, readPayload, readCrc
+    } state = waitSof;
+    uint8_t crc = 0;
+    uint8_t received = 0;
+    bool streaming = false;
+    uint32_t lastByteMillis = 0;
+
+  public:
+    // Payloads of this command go to streamSink, so they can be longer than CONTROL_MAX_PAYLOAD
+    uint8_t streamCommand = 0;
+    ControlStreamSink *streamSink = NULL;
+
+    uint8_t command = 0;
+    uint8_t length = 0;
+    uint8_t payload[CONTROL_MAX_PAYLOAD];
+    bool crcOK = false;
+    unsigned long framesReceived = 0;
+    unsigned long framesRejected = 0;
+
+    // Returns true when byte completes a frame; command/payload/crcOK then describe it until the next feed()
+    bool feed(uint8_t byte) {
+      lastByteMillis = millis();
+      switch (state) {
+        case waitSof:
+          if (byte == CONTROL_SOF) {
+            state = readCmd;
+            crc = 0;
+            streaming = false;
+          }
+          return false;
+        case readCmd:
+          command = byte;
+          crc = crc8Update(crc, byte);
+          state = readLen;
+          return false;
+        case readLen:
+          length = byte;
+          crc = crc8Update(crc, byte);
+          received = 0;
+          streaming = (streamSink != NULL && command == streamCommand);
+          if (streaming) {
+            streamSink->begin();
+          }
+          if (length > CONTROL_MAX_PAYLOAD && !streaming) {
+            ++framesRejected;
+            state = waitSof;
+          } else {
+            state = (length ? readPayload : readCrc);
+          }
+          return false;
+        case readPayload:
+          if (streaming) {
+            streamSink->feed(byte);
+            ++received;
+          } else {
+            payload[received++] = byte;
+          }
+          crc = crc8Update(crc, byte);
+          if (received == length) {
+            state = readCrc;
+          }
+          return false;
+        case readCrc:
+          crcOK = (byte == crc);
+          state = waitSof;
+          if (crcOK) {
+            ++framesReceived;
+          } else {
+            ++framesRejected;
+          }
+          return true;
+      }
+      return false;
+    }
+
+    // Call once no byte is waiting. Bytes still in the buffer arrived in time however long the loop took
+    // to read them, so the timeout only counts once the frame's bytes have really stopped. Without it a
+    // dropped byte would leave the parser counting the next frames as this one's payload.
+    void idle() {
+      if (state != waitSof && millis() - lastByteMillis > CONTROL_BYTE_TIMEOUT_MILLIS) {
+        ++framesRejected;
+        if (streaming) {
+          streamSink->reject();
+        }
+        state = waitSof;
+      }
+    }
+
+    uint8_t u8(uint8_t offset) {
+      return payload[offset];
+    }
+
+    int16_t i16(uint8_t offset) {
+      return (int16_t)(payload[offset] | (payload[offset + 1] << 8));
+    }
+};
+
+inline void sendControlFrame(uint8_t command, const void *payload, uint8_t length) {
+  const uint8_t *bytes = (const uint8_t *)payload;
+  uint8_t header[3] = {CONTROL_SOF, command, length};
+  uint8_t crc = crc8Update(crc8Update(0, command), length);
+  for (uint8_t i = 0; i < length; ++i) {
+    crc = crc8Update(crc, bytes[i]);
+  }
+  Serial.write(header, sizeof(header));
+  if (length) {
+    Serial.write(bytes, length);
+  }
+  Serial.write(crc);
+}
+
+inline void sendControlNak(uint8_t command, ControlError error) {
+  uint8_t payload[2] = {command, (uint8_t)error};
+  sendControlFrame(controlNak, payload, sizeof(payload));
+}
+
+#endif
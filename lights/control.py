@@ -0,0 +1,138 @@
+#!/usr/bin/env python3
+# Host side of the binary control protocol in control.h.
+#
+#   ./control.py /dev/ttyACM0 stats
+#   ./control.py /dev/ttyACM0 select 3 [variant]
+#   ./control.py /dev/ttyACM0 next | ping
+#   ./control.py /dev/ttyACM0 brightness 40
+#   ./control.py /dev/ttyACM0 param <id> <value>
+#   (ids from 128 up retune the pattern's oscillators: 128 + 4 * n + field, see oscillators.h)
+#
+# Works on any tty, including a pseudo-terminal. Log text from the pendant is skipped (or shown with -v).
+import argparse
+import os
+import select
+import struct
+import sys
+import termios
+import time
+
+SOF = 0xA5
+REPLY = 0x80
+NAK = 0x7F
+COMMANDS = {"ping": 0x01, "select": 0x02, "next": 0x03, "brightness": 0x04, "param": 0x05, "stats": 0x06}
+ERRORS = {1: "bad crc", 2: "unknown command", 3: "bad payload", 4: "rejected"}
+STATS = struct.Struct("<IHBhBHHIIHHHH")
+
+def crc8(data):
+	crc = 0
+	for byte in data:
+		crc ^= byte
+		for _ in range(8):
+			crc = ((crc << 1) ^ 0x07) & 0xFF if crc & 0x80 else (crc << 1) & 0xFF
+	return crc
+
+def frame(command, payload=b""):
+	body = bytes([command, len(payload)]) + payload
+	return bytes([SOF]) + body + bytes([crc8(body)])
+
+def open_port(path, baud):
+	fd = os.open(path, os.O_RDWR | os.O_NOCTTY)
+	attrs = termios.tcgetattr(fd)
+	attrs[0] = 0                                          # iflag
+	attrs[1] = 0                                          # oflag
+	attrs[2] = termios.CS8 | termios.CREAD | termios.CLOCAL
+	attrs[3] = 0                                          # lflag: raw
+	speed = getattr(termios, "B{}".format(baud), termios.B57600)
+	attrs[4] = attrs[5] = speed
+	termios.tcsetattr(fd, termios.TCSANOW, attrs)
+	return fd
+
+class FrameReader:
+	def __init__(self, fd, verbose):
+		self.fd = fd
+		self.verbose = verbose
+		self.buffer = bytearray()
+
+	def read(self, timeout):
+		"""Returns (command, payload) of the next valid frame, or None on timeout."""
+		deadline = time.time() + timeout
+		while True:
+			result = self.parse()
+			if result:
+				return result
+			remaining = deadline - time.time()
+			if remaining <= 0 or not select.select([self.fd], [], [], remaining)[0]:
+				return None
+			self.buffer += os.read(self.fd, 4096)
+
+	def parse(self):
+		while self.buffer:
+			start = self.buffer.find(SOF)
+			if start == -1:
+				self.log(self.buffer)
+				del self.buffer[:]
+				return None
+			self.log(self.buffer[:start])
+			del self.buffer[:start]
+			if len(self.buffer) < 3 or len(self.buffer) < 4 + self.buffer[2]:
+				return None
+			length = self.buffer[2]
+			body = bytes(self.buffer[1:3 + length])
+			if crc8(body) == self.buffer[3 + length]:
+				del self.buffer[:4 + length]
+				return body[0], body[2:]
+			del self.buffer[:1]
+		return None
+
+	def log(self, text):
+		if self.verbose and text:
+			sys.stderr.write(text.decode("ascii", "replace"))
+
+def request(fd, reader, command, payload=b"", timeout=1.0):
+	os.write(fd, frame(command, payload))
+	while True:
+		reply = reader.read(timeout)
+		if reply is None:
+			raise SystemExit("no reply to command 0x{:02x}".format(command))
+		code, data = reply
+		if code == NAK and data[0] == command:
+			raise SystemExit("command 0x{:02x} failed: {}".format(command, ERRORS.get(data[1], data[1])))
+		if code == command | REPLY:
+			return data
+
+def main():
+	parser = argparse.ArgumentParser()
+	parser.add_argument("port")
+	parser.add_argument("command", choices=sorted(COMMANDS))
+	parser.add_argument("args", nargs="*", type=int)
+	parser.add_argument("--baud", type=int, default=57600)
+	parser.add_argument("-v", dest="verbose", action="store_true", help="Show log text from the pendant")
+	args = parser.parse_args()
+
+	fd = open_port(args.port, args.baud)
+	reader = FrameReader(fd, args.verbose)
+	command = COMMANDS[args.command]
+	payload = b""
+	if args.command == "select":
+		payload = struct.pack("<B", args.args[0]) + (struct.pack("<h", args.args[1]) if len(args.args) > 1 else b"")
+	elif args.command == "brightness":
+		payload = struct.pack("<B", args.args[0])
+	elif args.command == "param":
+		payload = struct.pack("<Bh", args.args[0], args.args[1])
+
+	start = time.time()
+	data = request(fd, reader, command, payload)
+	elapsed = (time.time() - start) * 1000
+	if args.command == "stats":
+		(uptime, fps10, pattern, variant, brightness, scratch, scratch_high, received, rejected,
+			target_fps, awake, milliamps, battery_minutes) = STATS.unpack(data[:STATS.size])
+		print("uptime {:.1f}s  {:.1f} fps  pattern {} variant {}  brightness {}".format(uptime / 1000.0, fps10 / 10.0,
+			"none" if pattern == 0xFF else pattern, variant, brightness))
+		print("scratch {} bytes (high water {})  control frames {} ok, {} rejected".format(scratch, scratch_high, received, rejected))
+		print("target {} fps  awake {:.1f}%  ~{} mA  battery ~{}h{:02d}m".format(target_fps, awake / 10.0, milliamps, battery_minutes // 60, battery_minutes % 60))
+	else:
+		print("ok ({:.1f} ms)".format(elapsed))
+
+if __name__ == "__main__":
+	main()
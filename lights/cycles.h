@@ -0,0 +1,80 @@
+#ifndef CYCLES_H
+#define CYCLES_H
+
+#include "util.h"
+#include "patterns.h"
+
+// Core clock cycles from the Cortex-M4's DWT cycle counter. Unlike micros() it resolves single
+// instructions, and unlike timings from a desktop build it includes flash wait states, the in-order
+// pipeline's stalls and the soft-float calls for double maths, as they happen on the pendant.
+class CycleCounter {
+  public:
+    static void begin() {
+      ARM_DEMCR |= ARM_DEMCR_TRCENA;
+      ARM_DWT_CTRL |= ARM_DWT_CTRL_CYCCNTENA;
+    }
+
+    static uint32_t now() {
+      return ARM_DWT_CYCCNT;
+    }
+};
+
+// Cycles per loop() of every pattern kernel, each run from the same seed on a virtual clock, against the
+// cycles there are in a frame at the rate the pattern asks for. Logged as
+//   cycles <avg> avg <max> max <budget> budget <name>
+// for bench_report.py, which sets them beside the microsecond benchmarks.
+void benchmarkPatternCycles(CRGBArray<NUM_LEDS> &leds) {
+  const unsigned int kFrames = 2000;
+  const uint16_t kFrameMillis = 5;
+
+  PinkFlash pinkFlash;
+  StandingWaves standingWaves;
+  Droplets droplets;
+  SmoothPalettes smoothPalettes;
+  Bits bits[Bits::kPresetCount];
+  // variants run through every palette choice of one preset before the next preset
+  uint16_t paletteChoices = bits[0].variantCount() / Bits::kPresetCount;
+  for (uint8_t i = 0; i < Bits::kPresetCount; ++i) {
+    bits[i].setVariant(i * paletteChoices);
+  }
+  struct Kernel {
+    Pattern *pattern;
+    char name[40];
+  } kernels[4 + Bits::kPresetCount] = {
+    {&pinkFlash, "Pink Flash"},
+    {&standingWaves, "StandingWaves + Bits"},
+    {&droplets, "Droplets"},
+    {&smoothPalettes, "Smooth palettes"},
+  };
+  for (uint8_t i = 0; i < Bits::kPresetCount; ++i) {
+    kernels[4 + i].pattern = &bits[i];
+    snprintf(kernels[4 + i].name, sizeof(kernels[0].name), "Bits preset %u %s", i, Bits::presetName(i));
+  }
+
+  CycleCounter::begin();
+  logf("Pattern cycles per frame at %lu MHz (%u frames each):", (unsigned long)(F_CPU / 1000000), kFrames);
+  for (Kernel &kernel : kernels) {
+    Pattern *pattern = kernel.pattern;
+    gClock.useVirtualTime(1000);
+    random16_set_seed(1337);
+    leds.fill_solid(CRGB::Black);
+    pattern->start();
+    uint64_t total = 0;
+    uint32_t most = 0;
+    for (unsigned int frame = 0; frame < kFrames; ++frame) {
+      uint32_t start = CycleCounter::now();
+      pattern->loop(leds);
+      uint32_t cycles = CycleCounter::now() - start;
+      total += cycles;
+      most = max(most, cycles);
+      gClock.advance(kFrameMillis);
+    }
+    uint32_t budget = F_CPU / pattern->framerate();
+    pattern->stop();
+    logf("cycles %lu avg %lu max %lu budget %s", (unsigned long)(total / kFrames), (unsigned long)most, (unsigned long)budget, kernel.name);
+  }
+  gClock.useRealTime();
+  leds.fill_solid(CRGB::Black);
+}
+
+#endif
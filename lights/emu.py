@@ -0,0 +1,307 @@
+#!/usr/bin/env python3
+# Builds the firmware as a host program and runs it, for the checks that don't need a pendant.
+#
+#   ./emu.py --fastled ~/Arduino/libraries/FastLED run [-D NAME=VALUE ...] [--loops N] [--pty]
+#   ./emu.py --fastled ~/Arduino/libraries/FastLED golden [--record]
+#   ./emu.py --fastled ~/Arduino/libraries/FastLED check [NAME ...]
+#   ./emu.py --fastled ~/Arduino/libraries/FastLED control
+#   ./emu.py --fastled ~/Arduino/libraries/FastLED soak [--hours H]
+#   ./emu.py --fastled ~/Arduino/libraries/FastLED clip
+#   ./emu.py --fastled ~/Arduino/libraries/FastLED sync
+#   ./emu.py --fastled ~/Arduino/libraries/FastLED battery [--seconds S] [--awake-micros U]
+#
+# lights.ino is copied with the named #defines changed and built against emu/Arduino.h, which stands in for
+# the Teensy core, and FastLED built from its own sources with its stub platform. golden runs the
+# GOLDEN_CAPTURE pass and diffs it against goldens/ with golden.py; --record stores it there instead, for
+# when a change to the frames is meant. check builds and runs the emu/<name>_check.cpp programs (all of
+# them by default), each of which tests one part of the firmware and exits non-zero if it fails. control
+# runs the firmware on a pty and sends it every control command, with control.py's framing. soak runs the
+# SOAK_TEST build for a number of simulated hours, as fast as the host goes, and fails on any glitch. clip
+# records lights.ino's clipRecordPattern with CLIP_RECORD and compiles it into clip_playback.h, which the
+# CLIP_PLAYBACK build plays as an idle pattern. sync runs the SYNC_SIMULATION pendants with lights.ino's
+# kSyncSim* settings and prints their report. battery runs each idle pattern at a few brightnesses through
+# PowerGovernor's frame rates and current model, and prints the estimated current and battery life.
+#
+# The host isn't a Cortex-M4: pointers and longs are twice the size, so the scratch arena is made bigger
+# to hold the same patterns, and nothing timed here says how fast a pendant is.
+import argparse
+import glob
+import os
+import re
+import struct
+import subprocess
+import sys
+import time
+
+HERE = os.path.dirname(os.path.realpath(__file__))
+EMU = os.path.join(HERE, "emu")
+# flags every host build changes from lights.ino's
+HOST_DEFINES = {"SCRATCH_ARENA_BYTES": "1024"}
+
+def write_if_changed(path, text):
+	if os.path.exists(path) and open(path).read() == text:
+		return
+	with open(path, "w") as out:
+		out.write(text)
+
+def write_sketch(path, defines):
+	"""Copies lights.ino with the #define lines at its top changed, as the Arduino IDE would build it."""
+	sketch = os.path.join(HERE, "lights.ino")
+	lines = open(sketch).read().split("\n")
+	remaining = dict(defines)
+	for i, line in enumerate(lines):
+		if line.startswith('#include "'):
+			break
+		match = re.match(r"#define (\w+)\b", line)
+		if match and match.group(1) in remaining:
+			lines[i] = "#define {} {}".format(match.group(1), remaining.pop(match.group(1)))
+	if remaining:
+		sys.exit("lights.ino has no #define for {}".format(", ".join(sorted(remaining))))
+	write_if_changed(path, '#include <Arduino.h>\n#line 1 "{}"\n{}'.format(sketch, "\n".join(lines)))
+
+def compile_flags(args, include_dirs):
+	return [args.optimize, "-g", "-std=gnu++17", "-Wno-deprecated-declarations", "-DFASTLED_STUB_IMPL"] + ["-I" + d for d in include_dirs]
+
+def fastled_library(args):
+	fastled_src = os.path.join(args.fastled, "src")
+	if not os.path.exists(os.path.join(fastled_src, "FastLED.h")):
+		sys.exit("no FastLED sources in {}".format(fastled_src))
+	build_dir = os.path.join(args.build, "fastled")
+	os.makedirs(build_dir, exist_ok=True)
+	objects = []
+	for source in sorted(glob.glob(os.path.join(fastled_src, "**", "*.cpp"), recursive=True)):
+		obj = os.path.join(build_dir, os.path.relpath(source, fastled_src).replace(os.sep, "_") + ".o")
+		if not os.path.exists(obj) or os.path.getmtime(obj) < os.path.getmtime(source):
+			run_command(args, [args.cxx] + compile_flags(args, [EMU, fastled_src]) + ["-c", source, "-o", obj])
+		objects.append(obj)
+	library = os.path.join(build_dir, "libfastled.a")
+	if not os.path.exists(library) or any(os.path.getmtime(o) > os.path.getmtime(library) for o in objects):
+		if os.path.exists(library):
+			os.remove(library)
+		run_command(args, ["ar", "rcs", library] + objects)
+	return library
+
+def build(args, name, source, defines):
+	"""Builds emu/<source> against a copy of the sketch with the given flags, as build/<name>/<name>."""
+	build_dir = os.path.join(args.build, name)
+	os.makedirs(build_dir, exist_ok=True)
+	all_defines = dict(HOST_DEFINES)
+	all_defines.update(defines)
+	write_sketch(os.path.join(build_dir, "sketch.cpp"), all_defines)
+	library = fastled_library(args)
+	program = os.path.join(build_dir, name)
+	include_dirs = [build_dir, EMU, HERE, os.path.join(args.fastled, "src")]
+	run_command(args, [args.cxx] + compile_flags(args, include_dirs) + [os.path.join(EMU, source), library, "-lutil", "-o", program])
+	return program
+
+def run_command(args, command, **kwargs):
+	if args.verbose:
+		print(" ".join(command))
+	return subprocess.run(command, check=True, **kwargs)
+
+def parse_defines(values):
+	defines = {}
+	for value in values:
+		name, _, setting = value.partition("=")
+		defines[name] = setting or "1"
+	return defines
+
+def run(args):
+	program = build(args, "pendant", "pendant.cpp", parse_defines(args.define))
+	command = [program] + (["--loops", str(args.loops)] if args.loops is not None else []) + (["--pty"] if args.pty else [])
+	try:
+		run_command(args, command)
+	except KeyboardInterrupt:
+		pass
+
+def golden(args):
+	program = build(args, "golden", "pendant.cpp", {"GOLDEN_CAPTURE": "1"})
+	log = os.path.join(args.build, "golden.log")
+	with open(log, "w") as out:
+		run_command(args, [program, "--loops", "0"], stdout=out)
+	goldens = os.path.join(HERE, "goldens")
+	tool = os.path.join(HERE, "golden.py")
+	if args.record:
+		run_command(args, [tool, "record", log, goldens])
+		return
+	if not glob.glob(os.path.join(goldens, "*.gold")):
+		sys.exit("no goldens in {} yet: record them with --record from a build whose frames are right".format(goldens))
+	result = subprocess.run([tool, "diff", log, goldens, "--tolerance", str(args.tolerance), "--max-bad-pixels", str(args.max_bad_pixels)])
+	sys.exit(result.returncode)
+
+def check(args):
+	sources = sorted(glob.glob(os.path.join(EMU, "*_check.cpp")))
+	names = [os.path.basename(s)[:-len("_check.cpp")] for s in sources]
+	for name in args.names:
+		if name not in names:
+			sys.exit("no emu/{}_check.cpp".format(name))
+	failed = []
+	for name in args.names or names:
+		program = build(args, name + "_check", name + "_check.cpp", {})
+		print("== {}".format(name))
+		sys.stdout.flush()
+		if subprocess.run([program]).returncode != 0:
+			failed.append(name)
+	if failed:
+		sys.exit("failed: {}".format(", ".join(failed)))
+
+def start_pty_pendant(args, name, defines):
+	"""Runs a host pendant with Serial on a pty. Returns the process and the pty's path."""
+	program = build(args, name, "pendant.cpp", defines)
+	process = subprocess.Popen([program, "--pty"], stdout=subprocess.DEVNULL, stderr=subprocess.PIPE, universal_newlines=True)
+	words = process.stderr.readline().split()
+	if words[:2] != ["emu", "pty"]:
+		process.kill()
+		sys.exit("{} didn't open a pty".format(program))
+	return process, words[2]
+
+def control_test(args):
+	sys.path.insert(0, HERE)
+	import control
+	process, path = start_pty_pendant(args, "control", {})
+	fd = control.open_port(path, 57600)
+	reader = control.FrameReader(fd, args.verbose)
+	failures = []
+
+	def exchange(name, data, expect_command, expect_payload=None):
+		os.write(fd, data)
+		reply = reader.read(1.0)
+		ok = reply is not None and reply[0] == expect_command and (expect_payload is None or reply[1] == expect_payload)
+		print("{:40} {}".format(name, "ok" if ok else "FAIL ({})".format(reply)))
+		if not ok:
+			failures.append(name)
+		return reply
+
+	def stats():
+		reply = exchange("stats", control.frame(control.COMMANDS["stats"]), control.COMMANDS["stats"] | control.REPLY)
+		return control.STATS.unpack(reply[1][:control.STATS.size]) if reply else None
+
+	def nak(command, error):
+		return bytes([command, error])
+
+	try:
+		ping = control.COMMANDS["ping"]
+		select = control.COMMANDS["select"]
+		exchange("ping", control.frame(ping), ping | control.REPLY)
+		exchange("select 2", control.frame(select, struct.pack("<Bh", 2, -1)), select | control.REPLY)
+		exchange("brightness 40", control.frame(control.COMMANDS["brightness"], b"\x28"), control.COMMANDS["brightness"] | control.REPLY)
+		exchange("next", control.frame(control.COMMANDS["next"]), control.COMMANDS["next"] | control.REPLY)
+		before = stats()
+		exchange("select past the last pattern", control.frame(select, b"\x63"), control.NAK, nak(select, 3))
+		exchange("unknown command", control.frame(0x30), control.NAK, nak(0x30, 2))
+		bad = bytearray(control.frame(ping))
+		bad[-1] ^= 0xFF
+		exchange("bad crc", bytes(bad), control.NAK, nak(ping, 1))
+		whole = control.frame(ping)
+		os.write(fd, whole[:2])
+		time.sleep(0.01)
+		exchange("ping split by a short pause", whole[2:], ping | control.REPLY)
+		os.write(fd, control.frame(select, b"\x01")[:3])
+		time.sleep(0.3)
+		exchange("ping after a cut off frame", whole, ping | control.REPLY)
+		after = stats()
+		if before and after:
+			checks = [("pattern after next is 3", after[2] == 3), ("brightness is 40", after[4] == 40),
+				("bad crc and cut off frame rejected", after[8] - before[8] == 2)]
+			for name, ok in checks:
+				print("{:40} {}".format(name, "ok" if ok else "FAIL"))
+				if not ok:
+					failures.append(name)
+	finally:
+		os.close(fd)
+		process.kill()
+		process.wait()
+	if failures:
+		sys.exit("failed: {}".format(", ".join(failures)))
+
+def sketch_constant(name):
+	match = re.search(r"\b{} = ([^;]+);".format(name), open(os.path.join(HERE, "lights.ino")).read())
+	if not match:
+		sys.exit("lights.ino has no {}".format(name))
+	return eval(match.group(1), {})
+
+def soak(args):
+	program = build(args, "soak", "pendant.cpp", {"SOAK_TEST": "1"})
+	loops = int(args.hours * 3600000 / sketch_constant("kSoakStepMillis"))
+	process = subprocess.Popen([program, "--loops", str(loops)], stdout=subprocess.PIPE, universal_newlines=True)
+	glitches = 0
+	for line in process.stdout:
+		if line.startswith("Soak") or line.startswith("SOAK"):
+			sys.stdout.write(line)
+		glitches += line.startswith("SOAK GLITCH")
+	if process.wait() != 0:
+		sys.exit("soak exited with {}".format(process.returncode))
+	if glitches:
+		sys.exit("{} glitches".format(glitches))
+
+def clip(args):
+	program = build(args, "clip", "pendant.cpp", {"CLIP_RECORD": "1"})
+	log = os.path.join(args.build, "clip.log")
+	with open(log, "w") as out:
+		run_command(args, [program, "--loops", "0"], stdout=out)
+	run_command(args, [os.path.join(HERE, "clip_compiler.py"), log, "playback"])
+
+def sync(args):
+	program = build(args, "sync", "pendant.cpp", {"SYNC_SIMULATION": "1"})
+	run_command(args, [program, "--loops", "0"])
+
+def battery(args):
+	program = build(args, "battery", "battery.cpp", {})
+	run_command(args, [program, "--seconds", str(args.seconds), "--awake-micros", str(args.awake_micros)])
+
+def main():
+	parser = argparse.ArgumentParser()
+	parser.add_argument("--fastled", required=True, help="FastLED library directory (the one holding src/)")
+	parser.add_argument("--build", default=os.path.join(EMU, "build"), help="Build directory")
+	parser.add_argument("--cxx", default="g++")
+	parser.add_argument("--optimize", default="-O2")
+	parser.add_argument("-v", dest="verbose", action="store_true", help="Show the commands run")
+	subparsers = parser.add_subparsers(dest="command")
+
+	run_parser = subparsers.add_parser("run", help="Run the firmware on the host")
+	run_parser.add_argument("-D", dest="define", action="append", default=[], metavar="NAME=VALUE", help="Change a lights.ino flag")
+	run_parser.add_argument("--loops", type=int, help="Stop after this many loop() calls")
+	run_parser.add_argument("--pty", action="store_true", help="Put Serial on a pseudo terminal, for control.py and stream.py")
+	run_parser.set_defaults(func=run)
+
+	golden_parser = subparsers.add_parser("golden", help="Capture every pattern and diff against goldens/")
+	golden_parser.add_argument("--record", action="store_true", help="Store the capture as the new goldens")
+	golden_parser.add_argument("--tolerance", type=int, default=0, help="As golden.py diff's")
+	golden_parser.add_argument("--max-bad-pixels", type=float, default=0.0, help="As golden.py diff's")
+	golden_parser.set_defaults(func=golden)
+
+	check_parser = subparsers.add_parser("check", help="Build and run the emu/*_check.cpp programs")
+	check_parser.add_argument("names", nargs="*", help="Which checks, as in emu/<name>_check.cpp")
+	check_parser.set_defaults(func=check)
+
+	control_parser = subparsers.add_parser("control", help="Send every control command to the firmware over a pty")
+	control_parser.set_defaults(func=control_test)
+
+	soak_parser = subparsers.add_parser("soak", help="Run the soak test for simulated hours")
+	soak_parser.add_argument("--hours", type=float, default=24 * 7, help="Simulated hours (default a week)")
+	soak_parser.set_defaults(func=soak)
+
+	clip_parser = subparsers.add_parser("clip", help="Record and compile clip_playback.h")
+	clip_parser.set_defaults(func=clip)
+
+	sync_parser = subparsers.add_parser("sync", help="Run the sync simulation")
+	sync_parser.set_defaults(func=sync)
+
+	battery_parser = subparsers.add_parser("battery", help="Estimate current and battery life for each pattern")
+	battery_parser.add_argument("--seconds", type=int, default=60, help="Simulated seconds a pattern (default 60)")
+	battery_parser.add_argument("--awake-micros", type=float, default=500,
+		help="Time a pendant is awake a frame, from control.py stats (default 500, a guess)")
+	battery_parser.set_defaults(func=battery)
+
+	args = parser.parse_args()
+	if not args.command:
+		parser.print_help()
+		sys.exit(2)
+	os.makedirs(args.build, exist_ok=True)
+	try:
+		args.func(args)
+	except subprocess.CalledProcessError as error:
+		sys.exit("{} exited with {}".format(os.path.basename(error.cmd[0]), error.returncode))
+
+if __name__ == "__main__":
+	main()
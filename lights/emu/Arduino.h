@@ -0,0 +1,160 @@
+// Just enough of the Teensy's Arduino core to build the firmware as a host program for emu.py. Time is the
+// host's monotonic clock, Serial is a pair of file descriptors (stdout, or a pty the host tools can open
+// like a pendant's USB serial), and the touch pad and unconnected analog pin read from variables.
+#ifndef EMU_ARDUINO_H
+#define EMU_ARDUINO_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PROGMEM
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+#define pgm_read_word(addr) (*(const uint16_t *)(addr))
+#define pgm_read_dword(addr) (*(const uint32_t *)(addr))
+
+#ifndef min
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#endif
+#define constrain(x, low, high) ((x) < (low) ? (low) : ((x) > (high) ? (high) : (x)))
+
+#ifndef F_CPU
+#define F_CPU 96000000
+#endif
+
+inline uint64_t emuNanos() {
+  static struct timespec start = {0, 0};
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  if (start.tv_sec == 0 && start.tv_nsec == 0) {
+    start = now;
+  }
+  return (uint64_t)(now.tv_sec - start.tv_sec) * 1000000000 + now.tv_nsec - start.tv_nsec;
+}
+
+inline uint32_t micros() {
+  return emuNanos() / 1000;
+}
+
+inline uint32_t millis() {
+  return emuNanos() / 1000000;
+}
+
+inline void delayMicroseconds(uint32_t us) {
+  struct timespec wait = {(time_t)(us / 1000000), (long)(us % 1000000) * 1000};
+  while (nanosleep(&wait, &wait) != 0 && errno == EINTR) { }
+}
+
+inline void delay(uint32_t ms) {
+  delayMicroseconds(ms * 1000);
+}
+
+inline void yield() { }
+
+// The DWT cycle counter, as the host's clock at F_CPU. CycleCounter builds against it; the numbers mean
+// nothing for a pendant, so CYCLE_BENCHMARK stays an on-device run.
+static uint32_t ARM_DEMCR = 0;
+static uint32_t ARM_DWT_CTRL = 0;
+#define ARM_DEMCR_TRCENA (1 << 24)
+#define ARM_DWT_CTRL_CYCCNTENA 1
+#define ARM_DWT_CYCCNT ((uint32_t)(emuNanos() * (F_CPU / 1000000) / 1000))
+
+inline void randomSeed(unsigned long seed) {
+  srandom(seed);
+}
+
+inline long random(long howBig) {
+  return howBig ? ::random() % howBig : 0;
+}
+
+inline long random(long howSmall, long howBig) {
+  return howSmall >= howBig ? howSmall : howSmall + random(howBig - howSmall);
+}
+
+// What touchRead() and analogRead() return; a host program sets these to press the pad or fix the entropy
+static int emuTouchValue = 0;
+static int emuAnalogValue = -1;
+
+inline int touchRead(uint8_t) {
+  return emuTouchValue;
+}
+
+// -1 reads the clock, so each run seeds differently, as the floating pin does on a pendant
+inline int analogRead(uint8_t) {
+  return emuAnalogValue >= 0 ? emuAnalogValue : (int)(emuNanos() / 1000 % 1024);
+}
+
+inline void pinMode(uint8_t, uint8_t) { }
+inline void digitalWrite(uint8_t, uint8_t) { }
+
+class HardwareSerial {
+  public:
+    HardwareSerial(int inFd, int outFd) : inFd(inFd), outFd(outFd) { }
+
+    void attach(int in, int out) {
+      inFd = in;
+      outFd = out;
+      head = tail = 0;
+    }
+
+    void begin(unsigned long) { }
+
+    int available() {
+      if (head == tail && inFd >= 0) {
+        struct pollfd ready = {inFd, POLLIN, 0};
+        if (poll(&ready, 1, 0) > 0 && (ready.revents & POLLIN)) {
+          ssize_t count = ::read(inFd, buffer, sizeof(buffer));
+          head = 0;
+          tail = count > 0 ? count : 0;
+        }
+      }
+      return tail - head;
+    }
+
+    int read() {
+      return available() > 0 ? buffer[head++] : -1;
+    }
+
+    size_t write(const uint8_t *bytes, size_t length) {
+      size_t written = 0;
+      while (outFd >= 0 && written < length) {
+        ssize_t count = ::write(outFd, bytes + written, length - written);
+        if (count < 0 && errno != EINTR) {
+          // nobody reading a full pty: drop the rest, as the Teensy's USB serial does with no host
+          break;
+        }
+        written += count > 0 ? count : 0;
+      }
+      return written;
+    }
+
+    size_t write(uint8_t byte) { return write(&byte, 1); }
+    void print(const char *text) { write((const uint8_t *)text, strlen(text)); }
+    void println(const char *text) { print(text); print("\r\n"); }
+    int availableForWrite() { return 64; }
+    void flush() { }
+    operator bool() { return true; }
+
+  private:
+    int inFd;
+    int outFd;
+    uint8_t buffer[256];
+    int head = 0;
+    int tail = 0;
+};
+
+// USB serial on stdout until a host program attaches it elsewhere; Serial1's UART has nothing on the wire
+static HardwareSerial Serial(-1, STDOUT_FILENO);
+static HardwareSerial Serial1(-1, -1);
+
+#endif
@@ -0,0 +1,26 @@
+// The SPI port for emu.py's host build. Nothing is wired to it, so transfers go nowhere.
+#ifndef EMU_SPI_H
+#define EMU_SPI_H
+
+#include <Arduino.h>
+
+#define MSBFIRST 1
+#define SPI_MODE0 0x00
+
+class SPISettings {
+  public:
+    SPISettings(uint32_t, uint8_t, uint8_t) { }
+};
+
+class SPIClass {
+  public:
+    void begin() { }
+    void beginTransaction(SPISettings) { }
+    void endTransaction() { }
+    uint8_t transfer(uint8_t) { return 0; }
+    void transfer(const void *, void *, size_t) { }
+};
+
+static SPIClass SPI;
+
+#endif
@@ -0,0 +1,67 @@
+// Battery model on the host: every idle pattern runs in virtual time at each of a few brightnesses, at the
+// frame rate PowerGovernor picks for it untouched, and its frames go through the governor's current model.
+//   battery [--seconds S] [--awake-micros U]
+// The host can't say how long a pendant is awake per frame, so that is an input: take it from a pendant's
+// control.py stats (awake share / fps). The default is a guess. Each pattern starts from the same seed, so
+// runs compare.
+#include "sketch.cpp"
+
+const uint8_t kBrightnesses[] = {255, 128, 64, 32, 8};
+const uint16_t kSeed = 1337;
+
+int main(int argc, char **argv) {
+  uint32_t seconds = 60;
+  float awakeMicros = 500;
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i], "--seconds") && i + 1 < argc) {
+      seconds = atol(argv[++i]);
+    } else if (!strcmp(argv[i], "--awake-micros") && i + 1 < argc) {
+      awakeMicros = atof(argv[++i]);
+    } else {
+      fprintf(stderr, "usage: %s [--seconds S] [--awake-micros U]\n", argv[0]);
+      return 2;
+    }
+  }
+  // the patterns' logging isn't part of the report
+  Serial.attach(-1, -1);
+
+  PowerGovernor model;
+#if HD_OUTPUT
+  model.minFramerate = kHDDitherMinFramerate;
+#endif
+  printf("%u s a pattern, %.0f us awake a frame, %u mAh\n", seconds, awakeMicros, BATTERY_MAH);
+  printf("%-20s %10s %6s %7s %7s %7s %7s\n", "pattern", "brightness", "fps", "awake", "LED mA", "mA", "hours");
+  for (unsigned int p = 0; p < kIdlePatternsCount; ++p) {
+    Pattern *pattern = idlePatterns[p];
+    for (uint8_t brightness : kBrightnesses) {
+      gClock.useVirtualTime(1000);
+      random16_set_seed(kSeed);
+      randomSeed(kSeed);
+      leds.fill_solid(CRGB::Black);
+      pattern->start();
+      uint64_t elapsedMicros = 0;
+      uint64_t shownMicros = 0;
+      uint64_t awakeTotal = 0;
+      double ledMilliampMicros = 0;
+      uint16_t fps = 0;
+      while (elapsedMicros < (uint64_t)seconds * 1000000) {
+        pattern->loop(leds);
+        fps = model.chooseFramerate(pattern, brightness, false);
+        uint32_t frameMicros = 1000000 / fps;
+        ledMilliampMicros += model.ledCurrent(leds, NUM_LEDS, brightness) * frameMicros;
+        awakeTotal += min((uint32_t)awakeMicros, frameMicros);
+        elapsedMicros += frameMicros;
+        // whole milliseconds on the clock, as millis() would read them
+        gClock.advance((elapsedMicros - shownMicros) / 1000);
+        shownMicros += (elapsedMicros - shownMicros) / 1000 * 1000;
+      }
+      pattern->stop();
+      model.dutyCycle = awakeTotal / (float)elapsedMicros;
+      model.ledMilliamps = ledMilliampMicros / elapsedMicros;
+      printf("%-20.20s %10u %6u %6.1f%% %7.1f %7.1f %7.1f\n", pattern->description(), brightness, fps,
+             100 * model.dutyCycle, model.ledMilliamps, model.estimatedMilliamps(), model.batteryHours());
+    }
+  }
+  gClock.useRealTime();
+  return 0;
+}
@@ -0,0 +1,207 @@
+// Bits' compile-time presets against the runtime preset table they replaced: every preset, and every
+// variant, has to draw byte-identical frames to the old per-frame switch over 3000 frames from the same seed.
+// The reference keeps the old code's shape (a table read and a color switch every frame) with what has
+// changed since in both (FrameSteps for the fade, fadeup and fadedown over the preset's own lifespan).
+#include "sketch.cpp"
+
+const unsigned int kFrames = 3000;
+const uint16_t kFrameMillis = 5;
+const uint16_t kSeed = 1337;
+
+enum ReferenceColor {
+  monotone, fromPalette, mix, white, pink
+};
+
+struct ReferencePreset {
+  unsigned int maxBits, bitLifespan, updateInterval;
+  uint8_t fadedown;
+  ReferenceColor color;
+};
+
+// in the order of Bits::presets()
+const ReferencePreset kReferencePresets[Bits::kPresetCount] = {
+  { 5, 3000, 8, 12, pink }, // pink triangle
+  { 5, 3000, 16, 5, monotone }, // chill streamers
+  { 5, 3000, 16, 5, fromPalette }, // palette chill streamers
+  { 10, 3000, 16, 30, monotone }, // moving dots
+  { 3, 3000, 8, 50, monotone }, // chase
+};
+
+class ReferenceBits {
+    struct Bit {
+      int8_t direction;
+      unsigned long birthdate;
+      unsigned int pos;
+      bool alive;
+      unsigned long lastTick;
+      CRGB color;
+      void reset(CRGB color) {
+        birthdate = gClock.millis();
+        alive = true;
+        pos = random16() % NUM_LEDS;
+        direction = random8(2) == 0 ? 1 : -1;
+        this->color = color;
+      }
+      unsigned int age() {
+        return gClock.millis() - birthdate;
+      }
+      fract8 ageBrightness(unsigned int lifespan) {
+        float theAge = age();
+        if (theAge < 500) {
+          return theAge * 0xFF / 500;
+        } else if (theAge > lifespan - 500) {
+          return (lifespan - theAge) * 0xFF / 500;
+        }
+        return 0xFF;
+      }
+      void tick() {
+        pos = mod_wrap(pos + direction, NUM_LEDS);
+        lastTick = gClock.millis();
+      }
+    };
+
+    ReferencePreset preset;
+    Bit bits[Bits::kMaxBits];
+    unsigned int numBits = 0;
+    unsigned int lastBitCreation = 0;
+    CRGB color;
+    CRGBPalette16 palette;
+    FrameSteps steps;
+
+    CRGB getBitColor() {
+      switch (preset.color) {
+        case monotone:
+          return color;
+        case fromPalette:
+          return ColorFromPalette(palette, random8());
+        case mix:
+          return fastHSV(random8(), random8(200, 255), 255);
+        case white:
+          return CRGB::White;
+        case pink:
+        default:
+          return CRGB::DeepPink;
+      }
+    }
+
+  public:
+    // paletteChoice -1 picks at random, as a const preset does
+    void start(uint8_t pick, int paletteChoice) {
+      preset = kReferencePresets[pick];
+      if (preset.color == fromPalette) {
+        unsigned int choice = (paletteChoice != -1 ? paletteChoice : random8(4 + 1));
+        switch (choice) {
+          case 0: palette = OceanColors_p; break;
+          case 1: palette = LavaColors_p; break;
+          case 2: palette = ForestColors_p; break;
+          case 3: palette = PartyColors_p; break;
+          default:
+            loadGradientPalette(palette, paletteChoice != -1 ? choice - 4 : random16(gGradientPaletteCount));
+        }
+      }
+      color = CHSV(random8(), random8(8) == 0 ? 0 : random8(200, 255), 255);
+      steps.reset(gClock.millis());
+    }
+
+    void update(CRGBArray<NUM_LEDS> &leds) {
+      unsigned long mils = gClock.millis();
+      for (unsigned int i = 0; i < preset.maxBits && i < numBits; ++i) {
+        Bit *bit = &bits[i];
+        if (bit->age() > preset.bitLifespan) {
+          bit->alive = false;
+        }
+        if (bit->alive) {
+          leds[bit->pos] = blend(CRGB::Black, bit->color, bit->ageBrightness(preset.bitLifespan));
+          if (mils - bit->lastTick > preset.updateInterval) {
+            bit->tick();
+          }
+        } else {
+          bit->reset(getBitColor());
+        }
+      }
+      if (numBits < preset.maxBits && mils - lastBitCreation > preset.bitLifespan / preset.maxBits) {
+        bits[numBits++].reset(getBitColor());
+        lastBitCreation = mils;
+      }
+      for (uint16_t frames = steps.elapsed(mils, fadeStepsToBlack(preset.fadedown)); frames > 0; --frames) {
+        leds.fadeToBlackBy(preset.fadedown);
+      }
+    }
+};
+
+static uint8_t expected[kFrames][NUM_LEDS * 3];
+
+static void runReference(uint8_t pick, int paletteChoice) {
+  static ReferenceBits reference;
+  reference = ReferenceBits();
+  CRGBArray<NUM_LEDS> frame;
+  frame.fill_solid(CRGB::Black);
+  gClock.useVirtualTime(1000);
+  random16_set_seed(kSeed);
+  reference.start(pick, paletteChoice);
+  for (unsigned int i = 0; i < kFrames; ++i) {
+    reference.update(frame);
+    memcpy(expected[i], frame[0].raw, NUM_LEDS * 3);
+    gClock.advance(kFrameMillis);
+  }
+}
+
+// Returns the first frame that differs from expected, or kFrames
+static unsigned int compare(Bits &bits) {
+  CRGBArray<NUM_LEDS> frame;
+  frame.fill_solid(CRGB::Black);
+  gClock.useVirtualTime(1000);
+  random16_set_seed(kSeed);
+  bits.start();
+  unsigned int differs = kFrames;
+  for (unsigned int i = 0; i < kFrames && differs == kFrames; ++i) {
+    bits.loop(frame);
+    if (memcmp(expected[i], frame[0].raw, NUM_LEDS * 3)) {
+      differs = i;
+    }
+    gClock.advance(kFrameMillis);
+  }
+  bits.stop();
+  return differs;
+}
+
+int main() {
+  Serial.attach(-1, -1);
+  bool ok = true;
+
+  for (uint8_t pick = 0; pick < Bits::kPresetCount; ++pick) {
+    static Bits bits(pick);
+    bits = Bits(pick);
+    runReference(pick, -1);
+    unsigned int differs = compare(bits);
+    if (differs != kFrames) {
+      printf("FAIL: preset %u (%s) differs from the reference at frame %u\n", pick, Bits::presetName(pick), differs);
+      ok = false;
+    }
+  }
+
+  // variants run through the presets in order, with a palette choice each only where the preset uses one
+  static Bits bits;
+  unsigned int variant = 0;
+  for (uint8_t pick = 0; pick < Bits::kPresetCount; ++pick) {
+    uint16_t choices = kReferencePresets[pick].color == fromPalette ? 4 + gGradientPaletteCount : 1;
+    for (uint16_t choice = 0; choice < choices; ++choice, ++variant) {
+      bits.setVariant(variant);
+      runReference(pick, kReferencePresets[pick].color == fromPalette ? choice : -1);
+      unsigned int differs = compare(bits);
+      if (differs != kFrames) {
+        printf("FAIL: variant %u (preset %u, palette %u) differs from the reference at frame %u\n", variant, pick,
+               choice, differs);
+        ok = false;
+      }
+    }
+  }
+  if (variant != bits.variantCount()) {
+    printf("FAIL: Bits has %u variants, the presets have %u\n", bits.variantCount(), variant);
+    ok = false;
+  }
+
+  gClock.useRealTime();
+  printf("%s\n", ok ? "ok" : "FAILED");
+  return ok ? 0 : 1;
+}
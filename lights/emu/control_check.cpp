@@ -0,0 +1,93 @@
+// ControlParser's byte timeout against real time: a frame whose bytes sat in the serial buffer while the
+// loop was busy has to survive, and one whose bytes really stopped has to be dropped once the buffer runs dry.
+#include "sketch.cpp"
+
+class CountingSink : public ControlStreamSink {
+  public:
+    unsigned int begun = 0;
+    unsigned int fed = 0;
+    unsigned int rejected = 0;
+    void begin() { ++begun; }
+    void feed(uint8_t) { ++fed; }
+    void reject() { ++rejected; }
+};
+
+static bool ok = true;
+
+static void expect(bool condition, const char *what) {
+  if (!condition) {
+    printf("FAIL: %s\n", what);
+    ok = false;
+  }
+}
+
+// a frame as sendControlFrame() writes it
+static uint8_t frame(uint8_t *out, uint8_t command, const uint8_t *payload, uint8_t length) {
+  out[0] = CONTROL_SOF;
+  out[1] = command;
+  out[2] = length;
+  uint8_t crc = crc8Update(crc8Update(0, command), length);
+  for (uint8_t i = 0; i < length; ++i) {
+    out[3 + i] = payload[i];
+    crc = crc8Update(crc, payload[i]);
+  }
+  out[3 + length] = crc;
+  return 4 + length;
+}
+
+// feeds bytes [from, to), returning whether the last one completed a frame
+static bool feed(ControlParser &parser, const uint8_t *bytes, uint8_t from, uint8_t to) {
+  bool completed = false;
+  for (uint8_t i = from; i < to; ++i) {
+    completed = parser.feed(bytes[i]);
+  }
+  return completed;
+}
+
+int main() {
+  const uint8_t payload[4] = {1, 2, 3, 4};
+  uint8_t bytes[CONTROL_MAX_PAYLOAD + 4];
+  uint8_t length = frame(bytes, controlSetParameter, payload, sizeof(payload));
+  const uint32_t kSlowLoopMillis = 3 * CONTROL_BYTE_TIMEOUT_MILLIS;
+
+  ControlParser parser;
+  expect(feed(parser, bytes, 0, length) && parser.crcOK && parser.length == sizeof(payload), "a whole frame parses");
+
+  // the rest of the frame arrived during a slow loop, and is read after it
+  feed(parser, bytes, 0, 3);
+  parser.idle();
+  delay(kSlowLoopMillis);
+  expect(feed(parser, bytes, 3, length) && parser.crcOK, "a frame read across a slow loop completes");
+  expect(parser.framesRejected == 0, "nothing rejected across a slow loop");
+
+  // idle within the timeout keeps the frame
+  feed(parser, bytes, 0, 3);
+  parser.idle();
+  expect(feed(parser, bytes, 3, length) && parser.crcOK, "a frame with a short gap completes");
+
+  // the frame's bytes stopped: dropped once the buffer is empty, and the next frame still parses
+  feed(parser, bytes, 0, 4);
+  delay(kSlowLoopMillis);
+  parser.idle();
+  expect(parser.framesRejected == 1, "a cut off frame is rejected");
+  expect(!feed(parser, bytes, 4, length), "the tail of a dropped frame isn't a frame");
+  expect(feed(parser, bytes, 0, length) && parser.crcOK, "the next frame parses after a dropped one");
+
+  // a cut off streamed frame is rejected by its sink; a cut off header never reaches it
+  CountingSink sink;
+  parser.streamCommand = controlStreamFrame;
+  parser.streamSink = &sink;
+  length = frame(bytes, controlStreamFrame, payload, sizeof(payload));
+  feed(parser, bytes, 0, 5);
+  delay(kSlowLoopMillis);
+  parser.idle();
+  expect(sink.begun == 1 && sink.fed == 2 && sink.rejected == 1, "a cut off streamed frame is rejected by its sink");
+  feed(parser, bytes, 0, length);
+  feed(parser, bytes, 0, 2);
+  delay(kSlowLoopMillis);
+  parser.idle();
+  expect(sink.begun == 2 && sink.rejected == 1, "a frame cut off before its length doesn't reach the sink");
+
+  printf("%s\n", ok ? "ok" : "FAILED");
+  return ok ? 0 : 1;
+}
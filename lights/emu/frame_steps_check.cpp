@@ -0,0 +1,47 @@
+// FrameSteps against the clock moving back and long stalls, and fadeStepsToBlack() against FastLED's own
+// fadeToBlackBy().
+#include "sketch.cpp"
+
+static bool ok = true;
+
+static void expect(bool condition, const char *what) {
+  if (!condition) {
+    printf("FAIL: %s\n", what);
+    ok = false;
+  }
+}
+
+int main() {
+  // the step count is the fewest fades that leave a full white pixel black, for every fade amount
+  for (uint16_t fadeBy = 1; fadeBy < 256; ++fadeBy) {
+    CRGBArray<NUM_LEDS> pixels;
+    pixels.fill_solid(CRGB::White);
+    uint16_t steps = 0;
+    while (pixels[0].r || pixels[0].g || pixels[0].b) {
+      pixels.fadeToBlackBy(fadeBy);
+      ++steps;
+    }
+    if (steps != fadeStepsToBlack(fadeBy)) {
+      printf("FAIL: fadeToBlackBy(%u) takes %u steps to black, fadeStepsToBlack() says %u\n", fadeBy, steps,
+             fadeStepsToBlack(fadeBy));
+      ok = false;
+    }
+  }
+
+  const uint16_t kMax = fadeStepsToBlack(3);
+  FrameSteps steps;
+  steps.reset(1000);
+  expect(steps.elapsed(1010, kMax) == MAX_FRAMERATE / 100, "10 ms is that many frames");
+  // SYNC moved the clock back: no frames, then counting resumes from the new time
+  expect(steps.elapsed(900, kMax) == 0, "the clock moving back is no frames");
+  expect(steps.elapsed(910, kMax) == MAX_FRAMERATE / 100, "frames count again after the clock moved back");
+  // a stall, and one long enough to overflow the multiply, both stop at the cap
+  expect(steps.elapsed(910 + 60000, kMax) == kMax, "a minute's stall is capped");
+  expect(steps.elapsed(60910 + 0x10000000, kMax) == kMax, "a stall of days, past the multiply's range, is capped");
+  // the cap drops the carry, so the frame after a stall counts from there
+  uint32_t now = 60910 + 0x10000000;
+  expect(steps.elapsed(now + 5, kMax) == MAX_FRAMERATE / 200, "a frame after a stall counts from the stall");
+
+  printf("%s\n", ok ? "ok" : "FAILED");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,55 @@
+// fastHSV() against FastLED's hsv2rgb_rainbow for every hue, saturation and value: the ring's results have to
+// match exactly. Also times both over the same sweep. That says how the two compare on this machine, not on
+// a pendant, where the hue section maths runs as soft integer code; HSV_STATS times them there.
+#include "sketch.cpp"
+
+static uint64_t nanos() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+int main() {
+  const uint32_t kConversions = 1 << 24;
+  unsigned long mismatches = 0;
+  int maxError = 0;
+  for (uint32_t i = 0; i < kConversions; ++i) {
+    uint8_t hue = i >> 16, sat = i >> 8, val = i;
+    CRGB expected;
+    hsv2rgb_rainbow(CHSV(hue, sat, val), expected);
+    CRGB actual = fastHSV(hue, sat, val);
+    if (actual != expected) {
+      if (++mismatches <= 10) {
+        printf("FAIL: CHSV(%u, %u, %u) is %u,%u,%u from the ring, %u,%u,%u from hsv2rgb_rainbow\n", hue, sat, val,
+               actual.r, actual.g, actual.b, expected.r, expected.g, expected.b);
+      }
+      for (uint8_t c = 0; c < 3; ++c) {
+        maxError = max(maxError, abs(actual.raw[c] - expected.raw[c]));
+      }
+    }
+  }
+  if (mismatches) {
+    printf("%lu of %lu conversions differ, by up to %d\n", mismatches, (unsigned long)kConversions, maxError);
+  }
+
+  // the sink keeps either loop from being dropped
+  uint8_t sink = 0;
+  CRGB out;
+  uint64_t start = nanos();
+  for (uint32_t i = 0; i < kConversions; ++i) {
+    hsv2rgb_rainbow(CHSV(i >> 16, i >> 8, i), out);
+    sink += out.r ^ out.g ^ out.b;
+  }
+  uint64_t rainbowNanos = nanos() - start;
+  start = nanos();
+  for (uint32_t i = 0; i < kConversions; ++i) {
+    out = fastHSV(i >> 16, i >> 8, i);
+    sink += out.r ^ out.g ^ out.b;
+  }
+  uint64_t ringNanos = nanos() - start;
+  printf("hsv2rgb_rainbow %.2f ns, ring %.2f ns per conversion on this host (%u)\n",
+         rainbowNanos / (double)kConversions, ringNanos / (double)kConversions, sink);
+
+  printf("%s\n", mismatches ? "FAILED" : "ok");
+  return mismatches ? 1 : 0;
+}
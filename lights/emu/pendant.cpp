@@ -0,0 +1,43 @@
+// The firmware as a host program, built by emu.py from a copy of lights.ino with its flags overridden.
+// setup() runs, then loop() until --loops runs out or the process is killed.
+//   pendant [--loops N] [--pty]
+// With --pty, Serial is a pseudo terminal instead of stdout, and its path is printed on stderr as
+//   emu pty <path>
+// so control.py, stream.py and vm_asm.py can talk to it as they would to a pendant's USB serial.
+#include <pty.h>
+#include <termios.h>
+#include "sketch.cpp"
+
+static void attachPty() {
+  int master, slave;
+  char path[64];
+  struct termios raw;
+  cfmakeraw(&raw);
+  if (openpty(&master, &slave, path, &raw, NULL) != 0) {
+    perror("openpty");
+    exit(1);
+  }
+  // the slave stays open, so the pty outlives the host tools that open and close it
+  fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+  Serial.attach(master, master);
+  fprintf(stderr, "emu pty %s\n", path);
+}
+
+int main(int argc, char **argv) {
+  long loops = -1;
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i], "--loops") && i + 1 < argc) {
+      loops = atol(argv[++i]);
+    } else if (!strcmp(argv[i], "--pty")) {
+      attachPty();
+    } else {
+      fprintf(stderr, "usage: %s [--loops N] [--pty]\n", argv[0]);
+      return 2;
+    }
+  }
+  setup();
+  for (long i = 0; loops < 0 || i < loops; ++i) {
+    loop();
+  }
+  return 0;
+}
@@ -0,0 +1,144 @@
+// FrameStream's decoder, fed byte by byte through ControlParser as handleControlFrame() uses them. Random
+// keyframes and deltas, encoded with the clip ops as stream.py sends them, have to come out as the frames
+// that were encoded; a frame that fails its CRC must leave the last good one shown, and deltas after it are
+// refused until a keyframe.
+#include "sketch.cpp"
+
+const uint16_t kFrameBytes = NUM_LEDS * 3;
+
+static bool ok = true;
+
+static void expect(bool condition, const char *what, unsigned int frame) {
+  if (!condition) {
+    printf("FAIL: %s (frame %u)\n", what, frame);
+    ok = false;
+  }
+}
+
+// Clip ops for target against reference (NULL for a keyframe, against black): skips where they match,
+// repeats for runs of three or more of a byte, literals for the rest
+static uint16_t encode(uint8_t *ops, const uint8_t *target, const uint8_t *reference) {
+  static const uint8_t black[kFrameBytes] = {0};
+  if (!reference) {
+    reference = black;
+  }
+  uint16_t length = 0;
+  uint16_t pos = 0;
+  while (pos < kFrameBytes) {
+    uint16_t run = 0;
+    while (pos + run < kFrameBytes && run < 128 && target[pos + run] == reference[pos + run]) {
+      ++run;
+    }
+    if (run) {
+      ops[length++] = CLIP_OP_SKIP | (run - 1);
+      pos += run;
+      continue;
+    }
+    while (pos + run < kFrameBytes && run < 64 && target[pos + run] == target[pos]) {
+      ++run;
+    }
+    if (run >= 3) {
+      ops[length++] = CLIP_OP_REPEAT | (run - 1);
+      ops[length++] = target[pos];
+      pos += run;
+      continue;
+    }
+    uint16_t start = length++;
+    for (run = 0; pos < kFrameBytes && run < 64 && target[pos] != reference[pos]; ++run) {
+      ops[length++] = target[pos++];
+    }
+    ops[start] = CLIP_OP_LITERAL | (run - 1);
+  }
+  return length;
+}
+
+// Sends one controlStreamFrame through the parser into the stream. Returns whether it was committed.
+static bool send(ControlParser &parser, FrameStream &stream, uint8_t seq, bool keyframe, const uint8_t *ops,
+                 uint16_t opsLength, bool corrupt) {
+  uint8_t payload[2 + 2 * kFrameBytes];
+  payload[0] = seq;
+  payload[1] = keyframe ? STREAM_FLAG_KEYFRAME : 0;
+  memcpy(payload + 2, ops, opsLength);
+  uint16_t length = 2 + opsLength;
+  if (length > 255) {
+    printf("FAIL: frame %u encodes to %u bytes\n", seq, length);
+    ok = false;
+    return false;
+  }
+  uint8_t crc = crc8Update(crc8Update(0, controlStreamFrame), length);
+  for (uint16_t i = 0; i < length; ++i) {
+    crc = crc8Update(crc, payload[i]);
+  }
+  const CRGB *before = stream.shown();
+  parser.feed(CONTROL_SOF);
+  parser.feed(controlStreamFrame);
+  parser.feed(length);
+  for (uint16_t i = 0; i < length; ++i) {
+    parser.feed(payload[i]);
+  }
+  expect(stream.shown() == before, "the shown frame changed before the CRC", seq);
+  if (!parser.feed(corrupt ? crc ^ 0xFF : crc)) {
+    expect(false, "the frame didn't complete", seq);
+    return false;
+  }
+  if (!parser.crcOK) {
+    stream.reject();
+    return false;
+  }
+  return stream.commit();
+}
+
+int main() {
+  CRGBArray<NUM_LEDS> leds;
+  FrameStream stream(leds);
+  ControlParser parser;
+  parser.streamCommand = controlStreamFrame;
+  parser.streamSink = &stream;
+  srandom(1337);
+
+  uint8_t target[kFrameBytes];
+  uint8_t shown[kFrameBytes];
+  uint8_t ops[2 * kFrameBytes];
+  for (uint16_t i = 0; i < kFrameBytes; ++i) {
+    target[i] = (i % 9 < 4) ? 0 : random(256);
+  }
+  expect(send(parser, stream, 0, true, ops, encode(ops, target, NULL), false), "keyframe refused", 0);
+  expect(!memcmp(stream.shown(), target, kFrameBytes), "keyframe decoded wrong", 0);
+  memcpy(shown, target, kFrameBytes);
+
+  for (unsigned int n = 1; n < 500; ++n) {
+    bool keyframe = (n % 50 == 0);
+    bool corrupt = (n % 37 == 0);
+    // a few pixels change, and sometimes a run of one colour
+    for (unsigned int change = random(8); change > 0; --change) {
+      target[random(kFrameBytes)] = random(256);
+    }
+    if (n % 7 == 0) {
+      uint16_t start = random(kFrameBytes - 12);
+      memset(target + start, random(256), 12);
+    }
+    uint16_t length = encode(ops, target, keyframe ? NULL : shown);
+    bool committed = send(parser, stream, n, keyframe, ops, length, corrupt);
+    if (corrupt) {
+      expect(!committed, "a frame with a bad CRC was committed", n);
+      expect(!memcmp(stream.shown(), shown, kFrameBytes), "a bad CRC changed the shown frame", n);
+      // the host moves on without knowing; its next delta has to be refused and the last good frame kept
+      target[0] ^= 0x55;
+      length = encode(ops, target, shown);
+      expect(!send(parser, stream, n, false, ops, length, false), "a delta after a bad CRC was committed", n);
+      expect(!memcmp(stream.shown(), shown, kFrameBytes), "a refused delta changed the shown frame", n);
+      length = encode(ops, target, NULL);
+      committed = send(parser, stream, n, true, ops, length, false);
+    }
+    expect(committed, "a frame was refused", n);
+    expect(!memcmp(stream.shown(), target, kFrameBytes), "frame decoded wrong", n);
+    memcpy(shown, target, kFrameBytes);
+  }
+
+  // streaming stops with the last frame in leds, whichever buffer it was in
+  stream.reset();
+  expect(stream.shown() == (CRGB *)leds && !memcmp(leds[0].raw, shown, kFrameBytes), "the last frame isn't in leds after reset", 0);
+
+  printf("%s\n", ok ? "ok" : "FAILED");
+  return ok ? 0 : 1;
+}
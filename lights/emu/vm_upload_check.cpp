@@ -0,0 +1,69 @@
+// Uploads a program over one that is running from the upload buffer, then sends a third upload that fails
+// to verify. The second upload has to take over the running pattern, and the third must not touch its code:
+// the frames after it have to match a run without the third upload.
+#include "sketch.cpp"
+
+const unsigned int kFrames = 200;
+uint8_t referenceFrames[kFrames][NUM_LEDS * 3];
+uint8_t checkedFrames[kFrames][NUM_LEDS * 3];
+
+// in chunks, as vm_asm.py --load sends them
+static bool upload(VMPattern &vm, const uint8_t *program, uint16_t length) {
+  const uint16_t kChunk = 32;
+  bool ok = true;
+  for (uint16_t offset = 0; offset < length; offset += kChunk) {
+    uint16_t size = min(kChunk, (uint16_t)(length - offset));
+    ok = vm.receive(program + offset, size, offset == 0, offset + size == length);
+  }
+  return ok;
+}
+
+static bool run(uint8_t frames[kFrames][NUM_LEDS * 3], bool failedUpload) {
+  CRGBArray<NUM_LEDS> leds;
+  leds.fill_solid(CRGB::Black);
+  gClock.useVirtualTime(1000);
+  random16_set_seed(1337);
+  VMPattern vm(vmPrograms, ARRAY_SIZE(vmPrograms));
+  bool ok = upload(vm, vmSmoothPalettesData, sizeof(vmSmoothPalettesData));
+  vm.setVariant(vm.variantCount() - 1);
+  vm.start();
+  for (unsigned int i = 0; i < 50; ++i) {
+    vm.loop(leds);
+    gClock.advance(5);
+  }
+  ok = upload(vm, vmEmbersData, sizeof(vmEmbersData)) && ok;
+  if (!strstr(vm.description(), "Embers")) {
+    printf("FAIL: still running %s after uploading Embers over it\n", vm.description());
+    ok = false;
+  }
+  if (failedUpload) {
+    uint8_t garbage[VM_PROGRAM_BYTES];
+    memset(garbage, 0xFF, sizeof(garbage));
+    if (upload(vm, garbage, sizeof(garbage))) {
+      printf("FAIL: a program of 0xFF bytes verified\n");
+      ok = false;
+    }
+  }
+  for (unsigned int i = 0; i < kFrames; ++i) {
+    vm.loop(leds);
+    memcpy(frames[i], leds[0].raw, NUM_LEDS * 3);
+    gClock.advance(5);
+  }
+  vm.stop();
+  gClock.useRealTime();
+  return ok;
+}
+
+int main() {
+  bool ok = run(referenceFrames, false);
+  ok = run(checkedFrames, true) && ok;
+  for (unsigned int i = 0; i < kFrames; ++i) {
+    if (memcmp(referenceFrames[i], checkedFrames[i], NUM_LEDS * 3)) {
+      printf("FAIL: frame %u after the failed upload differs from the run without it\n", i);
+      ok = false;
+      break;
+    }
+  }
+  printf("%s\n", ok ? "ok" : "FAILED");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,39 @@
+#ifndef GOLDEN_H
+#define GOLDEN_H
+
+#include <FastLED.h>
+#include "util.h"
+#include "patterns.h"
+#include "clip.h"
+
+// Deterministic frame capture for golden.py. Every pattern runs from the same virtual time and RNG seed
+// with a fixed frame step, so two builds can be compared frame by frame. emu.py golden runs it as a host
+// program and diffs it against goldens/; a pendant built with GOLDEN_CAPTURE logs the same lines at boot:
+//   golden begin <frameMillis> <frameCount> <seed> <index>-<description>
+//   golden frame <hex bytes>
+//   golden end
+#define GOLDEN_START_MILLIS 1000
+
+void runGoldenCapture(Pattern **patterns, unsigned int count, CRGBArray<NUM_LEDS> &leds,
+                      unsigned int frames, uint16_t frameMillis, uint16_t seed) {
+  for (unsigned int i = 0; i < count; ++i) {
+    Pattern *pattern = patterns[i];
+    gClock.useVirtualTime(GOLDEN_START_MILLIS);
+    random16_set_seed(seed);
+    randomSeed(seed);
+    leds.fill_solid(CRGB::Black);
+
+    logf("golden begin %u %u %u %u-%s", frameMillis, frames, seed, i, pattern->description());
+    pattern->start();
+    for (unsigned int frame = 0; frame < frames; ++frame) {
+      pattern->loop(leds);
+      printFrame("golden frame", leds);
+      gClock.advance(frameMillis);
+    }
+    pattern->stop();
+    logf("golden end");
+  }
+  gClock.useRealTime();
+}
+
+#endif
@@ -0,0 +1,154 @@
+#!/usr/bin/env python3
+# Golden-frame regression checks for pattern changes.
+#
+# ./emu.py golden captures on the host and runs the diff below against goldens/. To check a pendant, build
+# with GOLDEN_CAPTURE set and save the serial output, then:
+#   ./golden.py record capture.log goldens/      store the reference run as goldens/<pattern>.gold
+#   ./golden.py diff capture.log goldens/        compare a new run against the stored goldens
+#
+# Either side of a diff can be a capture log or a directory of .gold files. A pattern fails when any
+# channel differs by more than --tolerance, on more than --max-bad-pixels percent of pixels.
+import argparse
+import math
+import os
+import re
+import struct
+import sys
+import zlib
+
+MAGIC = b"GOLD"
+VERSION = 1
+HEADER = struct.Struct("<4sBHHHH")
+
+class Capture:
+	def __init__(self, name, frame_millis, seed, frame_bytes):
+		self.name = name
+		self.frame_millis = frame_millis
+		self.seed = seed
+		self.frame_bytes = frame_bytes
+		self.frames = []
+
+def safe_name(name):
+	return re.sub(r"[^A-Za-z0-9_-]+", "_", name).strip("_")
+
+def read_log(path):
+	captures = {}
+	current = None
+	for line in open(path, errors="replace"):
+		words = line.split()
+		if len(words) < 2 or words[0] != "golden":
+			continue
+		if words[1] == "begin":
+			name = safe_name(" ".join(words[5:]))
+			current = Capture(name, int(words[2]), int(words[4]), None)
+			captures[name] = current
+		elif words[1] == "frame" and current is not None:
+			frame = bytes.fromhex(words[2])
+			current.frame_bytes = current.frame_bytes or len(frame)
+			if len(frame) == current.frame_bytes:
+				current.frames.append(frame)
+		elif words[1] == "end":
+			current = None
+	return captures
+
+def write_gold(capture, path):
+	with open(path, "wb") as out:
+		out.write(HEADER.pack(MAGIC, VERSION, capture.frame_bytes, len(capture.frames), capture.frame_millis, capture.seed))
+		out.write(zlib.compress(b"".join(capture.frames), 9))
+
+def read_gold(path):
+	data = open(path, "rb").read()
+	magic, version, frame_bytes, frame_count, frame_millis, seed = HEADER.unpack_from(data)
+	assert magic == MAGIC and version == VERSION, "{} is not a golden capture".format(path)
+	raw = zlib.decompress(data[HEADER.size:])
+	capture = Capture(os.path.splitext(os.path.basename(path))[0], frame_millis, seed, frame_bytes)
+	capture.frames = [raw[i:i + frame_bytes] for i in range(0, frame_count * frame_bytes, frame_bytes)]
+	return capture
+
+def load(path):
+	if os.path.isdir(path):
+		return dict((c.name, c) for c in (read_gold(os.path.join(path, f)) for f in sorted(os.listdir(path)) if f.endswith(".gold")))
+	return read_log(path)
+
+def compare(golden, run, tolerance):
+	frames = min(len(golden.frames), len(run.frames))
+	pixels = 0
+	bad_pixels = 0
+	max_error = 0
+	total_error = 0
+	squared_error = 0
+	first_bad_frame = None
+	for f in range(frames):
+		a, b = golden.frames[f], run.frames[f]
+		for p in range(0, len(a), 3):
+			errors = [abs(a[p + c] - b[p + c]) for c in range(3)]
+			worst = max(errors)
+			pixels += 1
+			max_error = max(max_error, worst)
+			total_error += sum(errors)
+			squared_error += sum(e * e for e in errors)
+			if worst > tolerance:
+				bad_pixels += 1
+				if first_bad_frame is None:
+					first_bad_frame = f
+	channels = max(1, pixels * 3)
+	mse = squared_error / float(channels)
+	return {
+		"frames": frames,
+		"max": max_error,
+		"mean": total_error / float(channels),
+		"psnr": float("inf") if mse == 0 else 10 * math.log10(255 * 255 / mse),
+		"bad": 100.0 * bad_pixels / max(1, pixels),
+		"first_bad_frame": first_bad_frame,
+	}
+
+def record(args):
+	captures = load(args.capture)
+	if not captures:
+		sys.exit("no golden captures in {}".format(args.capture))
+	if not os.path.isdir(args.goldens):
+		os.makedirs(args.goldens)
+	for capture in captures.values():
+		path = os.path.join(args.goldens, capture.name + ".gold")
+		write_gold(capture, path)
+		print("{}: {} frames, {} bytes".format(path, len(capture.frames), os.path.getsize(path)))
+
+def diff(args):
+	goldens = load(args.goldens)
+	runs = load(args.capture)
+	failed = False
+	for name in sorted(set(goldens) | set(runs)):
+		if name not in goldens or name not in runs:
+			print("{:32} missing from {}".format(name, args.goldens if name not in goldens else args.capture))
+			failed = True
+			continue
+		golden, run = goldens[name], runs[name]
+		if (golden.frame_millis, golden.seed) != (run.frame_millis, run.seed):
+			print("{:32} captured with different frame step or seed".format(name))
+			failed = True
+			continue
+		result = compare(golden, run, args.tolerance)
+		ok = result["bad"] <= args.max_bad_pixels and len(golden.frames) == len(run.frames)
+		failed = failed or not ok
+		print("{:32} {} frames {:4}  max {:3}  mean {:6.3f}  psnr {:6.2f}  over tolerance {:6.2f}%{}".format(
+			name, "ok  " if ok else "FAIL", result["frames"], result["max"], result["mean"], result["psnr"], result["bad"],
+			"" if result["first_bad_frame"] is None else "  (first at frame {})".format(result["first_bad_frame"])))
+	sys.exit(1 if failed else 0)
+
+parser = argparse.ArgumentParser()
+subparsers = parser.add_subparsers(dest="command")
+record_parser = subparsers.add_parser("record", help="Store a capture as golden files")
+record_parser.add_argument("capture")
+record_parser.add_argument("goldens")
+record_parser.set_defaults(func=record)
+diff_parser = subparsers.add_parser("diff", help="Compare a capture against golden files")
+diff_parser.add_argument("capture")
+diff_parser.add_argument("goldens")
+diff_parser.add_argument("--tolerance", type=int, default=0, help="Largest per-channel difference that still counts as a match")
+diff_parser.add_argument("--max-bad-pixels", type=float, default=0.0, help="Percent of pixels allowed over tolerance")
+diff_parser.set_defaults(func=diff)
+args = parser.parse_args()
+if not args.command:
+	parser.print_help()
+	sys.exit(2)
+args.func(args)
@@ -0,0 +1,154 @@
+#ifndef GRADIENTS_H
+#define GRADIENTS_H
+
+#include <FastLED.h>
+#include "util.h"
+
+// Patterns load gradient palettes through loadGradientPalette() so the flash format can be swapped.
+// PACKED_PALETTES uses the table generated by palette_compiler.py instead of the FastLED gradient definitions.
+#ifndef PACKED_PALETTES
+#define PACKED_PALETTES 1
+#endif
+
+#if !PACKED_PALETTES || PALETTE_BENCHMARK
+#include "palettes.h"
+#endif
+
+#if PACKED_PALETTES || PALETTE_BENCHMARK
+#include "palettes_packed.h"
+
+// Walks the anchors of one packed palette
+class PackedPaletteReader {
+  private:
+    const uint8_t *positions;
+    const uint8_t *colors;
+    uint8_t index;
+  public:
+    uint8_t count;
+    uint8_t position;
+    CRGB color;
+
+    PackedPaletteReader(uint8_t paletteIndex) {
+      const uint8_t *data = gPackedPaletteData + pgm_read_word(&gPackedPaletteOffsets[paletteIndex]);
+      count = pgm_read_byte(data);
+      positions = data + 1;
+      colors = positions + count - 2;
+      index = 0;
+      position = 0;
+      readColor();
+    }
+
+    bool next() {
+      if (++index >= count) {
+        return false;
+      }
+      position = (index == count - 1 ? 255 : position + pgm_read_byte(positions + index - 1));
+      readColor();
+      return true;
+    }
+
+  private:
+    void readColor() {
+      const uint8_t *rgb = colors + 3 * index;
+      color = CRGB(pgm_read_byte(rgb), pgm_read_byte(rgb + 1), pgm_read_byte(rgb + 2));
+    }
+};
+
+// Same slot assignment as CRGBPalette16's gradient palette constructor, so output matches exactly
+void decodePackedPalette(uint8_t paletteIndex, CRGBPalette16 &palette) {
+  PackedPaletteReader reader(paletteIndex);
+  int8_t lastSlotUsed = -1;
+  uint8_t indexStart = 0;
+  CRGB rgbStart = reader.color;
+  while (reader.next()) {
+    uint8_t istart8 = indexStart / 16;
+    uint8_t iend8 = reader.position / 16;
+    if (reader.count < 16) {
+      if (istart8 <= lastSlotUsed && lastSlotUsed < 15) {
+        istart8 = lastSlotUsed + 1;
+        if (iend8 < istart8) {
+          iend8 = istart8;
+        }
+      }
+      lastSlotUsed = iend8;
+    }
+    fill_gradient_RGB(palette.entries, istart8, rgbStart, iend8, reader.color);
+    indexStart = reader.position;
+    rgbStart = reader.color;
+  }
+}
+
+// Full 256-entry expansion, for patterns that want to skip ColorFromPalette interpolation
+void decodePackedPalette(uint8_t paletteIndex, CRGB entries[256]) {
+  PackedPaletteReader reader(paletteIndex);
+  uint8_t indexStart = 0;
+  CRGB rgbStart = reader.color;
+  while (reader.next()) {
+    fill_gradient_RGB(entries, indexStart, rgbStart, reader.position, reader.color);
+    indexStart = reader.position;
+    rgbStart = reader.color;
+  }
+}
+#endif
+
+#if PACKED_PALETTES && !PALETTE_BENCHMARK
+const uint8_t gGradientPaletteCount = gPackedPaletteCount;
+#endif
+
+inline void loadGradientPalette(CRGBPalette16 &palette, uint8_t paletteIndex) {
+#if PACKED_PALETTES
+  decodePackedPalette(paletteIndex, palette);
+#else
+  palette = gGradientPalettes[paletteIndex];
+#endif
+}
+
+#if PALETTE_BENCHMARK
+// Compares decode time of the packed table against FastLED's gradient palette decode, and checks they agree
+void benchmarkPaletteDecode() {
+  const int kRounds = 20;
+  CRGBPalette16 packed, reference;
+  unsigned long start = micros();
+  for (int round = 0; round < kRounds; ++round) {
+    for (uint8_t i = 0; i < gGradientPaletteCount; ++i) {
+      reference = gGradientPalettes[i];
+    }
+  }
+  unsigned long referenceMicros = micros() - start;
+
+  start = micros();
+  for (int round = 0; round < kRounds; ++round) {
+    for (uint8_t i = 0; i < gGradientPaletteCount; ++i) {
+      decodePackedPalette(i, packed);
+    }
+  }
+  unsigned long packedMicros = micros() - start;
+
+  CRGB *expanded = (CRGB *)malloc(256 * sizeof(CRGB));
+  start = micros();
+  for (int round = 0; round < kRounds; ++round) {
+    for (uint8_t i = 0; i < gGradientPaletteCount; ++i) {
+      decodePackedPalette(i, expanded);
+    }
+  }
+  unsigned long expandedMicros = micros() - start;
+  free(expanded);
+
+  unsigned mismatches = 0;
+  for (uint8_t i = 0; i < gGradientPaletteCount; ++i) {
+    reference = gGradientPalettes[i];
+    decodePackedPalette(i, packed);
+    if (packed != reference) {
+      logf("WARNING: packed palette %u does not match its gradient", i);
+      ++mismatches;
+    }
+  }
+
+  unsigned decodes = kRounds * gGradientPaletteCount;
+  logf("Palette decode: gradient %.2f us, packed %.2f us, packed 256 %.2f us (%u mismatches)",
+       referenceMicros / (float)decodes, packedMicros / (float)decodes, expandedMicros / (float)decodes, mismatches);
+  logf("Palette flash: packed %u bytes", (unsigned)(sizeof(gPackedPaletteData) + sizeof(gPackedPaletteOffsets)));
+}
+#endif
+
+#endif
@@ -0,0 +1,110 @@
+#ifndef HUERING_H
+#define HUERING_H
+
+#include <FastLED.h>
+#include "util.h"
+#include "huering_table.h"
+
+// Cheap CHSV -> CRGB for per-pixel hue patterns.
+// The 256 fully saturated, full value rainbow colors come from a flash table (huering.py writes it);
+// saturation and value are then applied with the same scale8 steps hsv2rgb_rainbow uses, so results
+// match it (with FASTLED_SCALE8_FIXED) while skipping the hue section math on every pixel. emu.py check
+// huering compares every CHSV against the FastLED it's built with.
+class HueRing {
+  private:
+    CRGB ring(uint8_t hue) {
+      const uint8_t *entry = gHueRingData + 3 * hue;
+      return CRGB(pgm_read_byte(entry), pgm_read_byte(entry + 1), pgm_read_byte(entry + 2));
+    }
+
+  public:
+#if HSV_STATS
+    unsigned long conversions = 0;
+    unsigned long desaturated = 0;
+#endif
+
+    CRGB rgb(uint8_t hue, uint8_t sat, uint8_t val) {
+#if HSV_STATS
+      ++conversions;
+#endif
+      CRGB color = ring(hue);
+      if (sat != 255) {
+#if HSV_STATS
+        ++desaturated;
+#endif
+        if (sat == 0) {
+          color = CRGB(255, 255, 255);
+        } else {
+          uint8_t desat = 255 - sat;
+          desat = scale8_video(desat, desat);
+          uint8_t satscale = 255 - desat;
+          color.r = scale8(color.r, satscale) + desat;
+          color.g = scale8(color.g, satscale) + desat;
+          color.b = scale8(color.b, satscale) + desat;
+        }
+      }
+      if (val != 255) {
+        val = scale8_video(val, val);
+        if (val == 0) {
+          return CRGB::Black;
+        }
+        color.r = scale8(color.r, val);
+        color.g = scale8(color.g, val);
+        color.b = scale8(color.b, val);
+      }
+      return color;
+    }
+
+#if HSV_STATS
+    // Checks the table against FastLED and times both paths once, then reports how much the ring saved
+    // per frame since the last report
+    void logStats(unsigned long frames) {
+      static float savedMicrosPerConversion = -1;
+      if (savedMicrosPerConversion < 0) {
+        unsigned mismatches = 0;
+        for (int hue = 0; hue < 256; ++hue) {
+          CRGB expected;
+          hsv2rgb_rainbow(CHSV(hue, 255, 255), expected);
+          if (ring(hue) != expected) {
+            ++mismatches;
+          }
+        }
+        if (mismatches) {
+          logf("HueRing: %u hues differ from this FastLED's hsv2rgb_rainbow; update huering.py and rerun it", mismatches);
+        }
+        const int kRounds = 4;
+        CRGB out;
+        uint8_t sink = 0;
+        unsigned long start = micros();
+        for (int i = 0; i < 256 * kRounds; ++i) {
+          hsv2rgb_rainbow(CHSV(i, 255, i >> 2), out);
+          sink += out.r;
+        }
+        unsigned long rainbowMicros = micros() - start;
+        start = micros();
+        for (int i = 0; i < 256 * kRounds; ++i) {
+          sink += rgb(i, 255, i >> 2).r;
+        }
+        unsigned long ringMicros = micros() - start;
+        conversions -= 256 * kRounds;
+        savedMicrosPerConversion = ((float)rainbowMicros - ringMicros) / (256 * kRounds);
+        logf("HueRing: hsv2rgb_rainbow %lu us vs ring %lu us per %u conversions (%u)", rainbowMicros, ringMicros, 256 * kRounds, sink);
+      }
+      if (frames > 0) {
+        float perFrame = conversions / (float)frames;
+        logf("HueRing: %.1f conversions/frame (%.0f%% desaturated), ~%.1f us/frame saved",
+             perFrame, conversions ? 100.0 * desaturated / conversions : 0.0, perFrame * savedMicrosPerConversion);
+      }
+      conversions = 0;
+      desaturated = 0;
+    }
+#endif
+};
+
+HueRing gHueRing;
+
+inline CRGB fastHSV(uint8_t hue, uint8_t sat, uint8_t val) {
+  return gHueRing.rgb(hue, sat, val);
+}
+
+#endif
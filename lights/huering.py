@@ -0,0 +1,61 @@
+#!/usr/bin/env python3
+# Writes the hue ring table in huering_table.h: hsv2rgb_rainbow(CHSV(hue, 255, 255)) for every hue, so
+# HueRing reads it from flash instead of building a 768 byte copy in RAM.
+#
+# This is FastLED's hsv2rgb_rainbow with its defaults (Y1 yellow boost, no green scaling) and
+# FASTLED_SCALE8_FIXED, cut down to full saturation and value. emu.py check huering compares the ring with
+# FastLED's hsv2rgb_rainbow for every CHSV, and HSV_STATS checks the table on a pendant; rerun this after
+# fixing it.
+#
+#   ./huering.py [huering_table.h]
+import os
+import sys
+
+def scale8(i, scale):
+	return (i * (1 + scale)) >> 8
+
+def rainbow(hue):
+	offset8 = (hue & 0x1F) << 3
+	third = scale8(offset8, 256 // 3)
+	twothirds = scale8(offset8, 512 // 3)
+	section = hue >> 5
+	if section == 0:
+		return (255 - third, third, 0)  # red -> orange
+	if section == 1:
+		return (171, 85 + third, 0)  # orange -> yellow
+	if section == 2:
+		return (171 - twothirds, 170 + third, 0)  # yellow -> green
+	if section == 3:
+		return (0, 255 - third, third)  # green -> aqua
+	if section == 4:
+		return (0, 171 - twothirds, 85 + twothirds)  # aqua -> blue
+	if section == 5:
+		return (third, 0, 255 - third)  # blue -> purple
+	if section == 6:
+		return (85 + third, 0, 171 - third)  # purple -> pink
+	return (170 + third, 0, 85 - third)  # pink -> red
+
+def byte_rows(values, per_row):
+	rows = []
+	for i in range(0, len(values), per_row):
+		rows.append("  " + ", ".join("{:3}".format(v) for v in values[i:i + per_row]) + ",")
+	return "\n".join(rows)
+
+def main():
+	os.chdir(os.path.dirname(os.path.realpath(__file__)))
+	dst_path = sys.argv[1] if len(sys.argv) > 1 else "huering_table.h"
+	data = []
+	for hue in range(256):
+		data.extend(rainbow(hue))
+	with open(dst_path, "w") as out:
+		out.write("// Generated by huering.py -- do not edit.\n")
+		out.write("//\n")
+		out.write("// hsv2rgb_rainbow(CHSV(hue, 255, 255)) as r, g, b for each hue, {} bytes of PROGMEM.\n".format(len(data)))
+		out.write("\n#ifndef HUERING_TABLE_H\n#define HUERING_TABLE_H\n\n")
+		out.write("const uint8_t gHueRingData[] PROGMEM = {\n")
+		out.write(byte_rows(data, 24))
+		out.write("\n};\n\n#endif\n")
+	print("{} bytes".format(len(data)))
+
+if __name__ == "__main__":
+	main()
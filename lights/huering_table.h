@@ -0,0 +1,43 @@
+// Generated by huering.py -- do not edit.
+//
+// hsv2rgb_rainbow(CHSV(hue, 255, 255)) as r, g, b for each hue, 768 bytes of PROGMEM.
+
+#ifndef HUERING_TABLE_H
+#define HUERING_TABLE_H
+
+const uint8_t gHueRingData[] PROGMEM = {
+  255,   0,   0, 253,   2,   0, 250,   5,   0, 247,   8,   0, 245,  10,   0, 242,  13,   0, 239,  16,   0, 237,  18,   0,
+  234,  21,   0, 231,  24,   0, 229,  26,   0, 226,  29,   0, 223,  32,   0, 221,  34,   0, 218,  37,   0, 215,  40,   0,
+  212,  43,   0, 210,  45,   0, 207,  48,   0, 204,  51,   0, 202,  53,   0, 199,  56,   0, 196,  59,   0, 194,  61,   0,
+  191,  64,   0, 188,  67,   0, 186,  69,   0, 183,  72,   0, 180,  75,   0, 178,  77,   0, 175,  80,   0, 172,  83,   0,
+  171,  85,   0, 171,  87,   0, 171,  90,   0, 171,  93,   0, 171,  95,   0, 171,  98,   0, 171, 101,   0, 171, 103,   0,
+  171, 106,   0, 171, 109,   0, 171, 111,   0, 171, 114,   0, 171, 117,   0, 171, 119,   0, 171, 122,   0, 171, 125,   0,
+  171, 128,   0, 171, 130,   0, 171, 133,   0, 171, 136,   0, 171, 138,   0, 171, 141,   0, 171, 144,   0, 171, 146,   0,
+  171, 149,   0, 171, 152,   0, 171, 154,   0, 171, 157,   0, 171, 160,   0, 171, 162,   0, 171, 165,   0, 171, 168,   0,
+  171, 170,   0, 166, 172,   0, 161, 175,   0, 155, 178,   0, 150, 180,   0, 145, 183,   0, 139, 186,   0, 134, 188,   0,
+  129, 191,   0, 123, 194,   0, 118, 196,   0, 113, 199,   0, 107, 202,   0, 102, 204,   0,  97, 207,   0,  91, 210,   0,
+   86, 213,   0,  81, 215,   0,  75, 218,   0,  70, 221,   0,  65, 223,   0,  59, 226,   0,  54, 229,   0,  49, 231,   0,
+   43, 234,   0,  38, 237,   0,  33, 239,   0,  27, 242,   0,  22, 245,   0,  17, 247,   0,  11, 250,   0,   6, 253,   0,
+    0, 255,   0,   0, 253,   2,   0, 250,   5,   0, 247,   8,   0, 245,  10,   0, 242,  13,   0, 239,  16,   0, 237,  18,
+    0, 234,  21,   0, 231,  24,   0, 229,  26,   0, 226,  29,   0, 223,  32,   0, 221,  34,   0, 218,  37,   0, 215,  40,
+    0, 212,  43,   0, 210,  45,   0, 207,  48,   0, 204,  51,   0, 202,  53,   0, 199,  56,   0, 196,  59,   0, 194,  61,
+    0, 191,  64,   0, 188,  67,   0, 186,  69,   0, 183,  72,   0, 180,  75,   0, 178,  77,   0, 175,  80,   0, 172,  83,
+    0, 171,  85,   0, 166,  90,   0, 161,  95,   0, 155, 101,   0, 150, 106,   0, 145, 111,   0, 139, 117,   0, 134, 122,
+    0, 129, 127,   0, 123, 133,   0, 118, 138,   0, 113, 143,   0, 107, 149,   0, 102, 154,   0,  97, 159,   0,  91, 165,
+    0,  86, 170,   0,  81, 175,   0,  75, 181,   0,  70, 186,   0,  65, 191,   0,  59, 197,   0,  54, 202,   0,  49, 207,
+    0,  43, 213,   0,  38, 218,   0,  33, 223,   0,  27, 229,   0,  22, 234,   0,  17, 239,   0,  11, 245,   0,   6, 250,
+    0,   0, 255,   2,   0, 253,   5,   0, 250,   8,   0, 247,  10,   0, 245,  13,   0, 242,  16,   0, 239,  18,   0, 237,
+   21,   0, 234,  24,   0, 231,  26,   0, 229,  29,   0, 226,  32,   0, 223,  34,   0, 221,  37,   0, 218,  40,   0, 215,
+   43,   0, 212,  45,   0, 210,  48,   0, 207,  51,   0, 204,  53,   0, 202,  56,   0, 199,  59,   0, 196,  61,   0, 194,
+   64,   0, 191,  67,   0, 188,  69,   0, 186,  72,   0, 183,  75,   0, 180,  77,   0, 178,  80,   0, 175,  83,   0, 172,
+   85,   0, 171,  87,   0, 169,  90,   0, 166,  93,   0, 163,  95,   0, 161,  98,   0, 158, 101,   0, 155, 103,   0, 153,
+  106,   0, 150, 109,   0, 147, 111,   0, 145, 114,   0, 142, 117,   0, 139, 119,   0, 137, 122,   0, 134, 125,   0, 131,
+  128,   0, 128, 130,   0, 126, 133,   0, 123, 136,   0, 120, 138,   0, 118, 141,   0, 115, 144,   0, 112, 146,   0, 110,
+  149,   0, 107, 152,   0, 104, 154,   0, 102, 157,   0,  99, 160,   0,  96, 162,   0,  94, 165,   0,  91, 168,   0,  88,
+  170,   0,  85, 172,   0,  83, 175,   0,  80, 178,   0,  77, 180,   0,  75, 183,   0,  72, 186,   0,  69, 188,   0,  67,
+  191,   0,  64, 194,   0,  61, 196,   0,  59, 199,   0,  56, 202,   0,  53, 204,   0,  51, 207,   0,  48, 210,   0,  45,
+  213,   0,  42, 215,   0,  40, 218,   0,  37, 221,   0,  34, 223,   0,  32, 226,   0,  29, 229,   0,  26, 231,   0,  24,
+  234,   0,  21, 237,   0,  18, 239,   0,  16, 242,   0,  13, 245,   0,  10, 247,   0,   8, 250,   0,   5, 253,   0,   2,
+};
+
+#endif
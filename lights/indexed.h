@@ -0,0 +1,37 @@
+#ifndef INDEXED_H
+#define INDEXED_H
+
+#include <FastLED.h>
+#include "util.h"
+
+// Palette-indexed frame: a palette index and a brightness per pixel, which a pattern that only shows palette
+// colors writes instead of leds. One fused resolve() pass turns it into leds: palette lookup, brightness, and
+// the blend over what the leds already hold. The frame is borrowed from scratch on top of leds, so it costs
+// RAM rather than saving it (96 bytes on a pendant). What it buys is that palette changes, and cross-fades
+// done on the palette's entries, show at the resolve's rate without running the pattern's per-pixel maths
+// again: SmoothPalettes, the one user, keeps its palette blend at full pace when its waves drop to half rate.
+#ifndef INDEXED_FRAMEBUFFER
+#define INDEXED_FRAMEBUFFER 0
+#endif
+
+struct IndexedFrame {
+  struct Pixel {
+    uint8_t index;
+    uint8_t level;
+  } pixels[NUM_LEDS];
+
+  void set(uint16_t i, uint8_t index, uint8_t level) {
+    pixels[i].index = index;
+    pixels[i].level = level;
+  }
+
+  // Writes the frame over leds, mixed in by mix (255 replaces them)
+  void resolve(CRGB *leds, const CRGBPalette16 &palette, fract8 mix) {
+    for (uint16_t i = 0; i < NUM_LEDS; ++i) {
+      const Pixel &pixel = pixels[i];
+      nblend(leds[i], ColorFromPalette(palette, pixel.index, pixel.level), mix);
+    }
+  }
+};
+
+#endif
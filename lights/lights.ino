@@ -1,18 +1,67 @@
+// Route FastLED's timing helpers through gClock (see util.h)
+#define USE_GET_MILLISECOND_TIMER
 #include <FastLED.h>
 
 #define SERIAL_LOGGING 1
+#define SERIAL_BAUD 57600
 #define STRIP_LENGTH 16
 #define STRIP_COUNT 3
 #define NUM_LEDS (STRIP_LENGTH * STRIP_COUNT)
+#define MAX_FRAMERATE 400
 #define UNCONNECTED_PIN 14
 #define TOUCH_PIN 33
+#define SCRATCH_ARENA_BYTES 512
+#define PACKED_PALETTES 1
+#define INDEXED_FRAMEBUFFER 1
+#define PALETTE_BENCHMARK 0
+#define BITS_BENCHMARK 0
+#define CYCLE_BENCHMARK 0
+#define VM_BENCHMARK 0
+#define HSV_STATS 0
+#define CLIP_RECORD 0
+#define CLIP_PLAYBACK 0
+#define GOLDEN_CAPTURE 0
+#define SOAK_TEST 0
+#define POWER_GOVERNOR 1
+#define POWER_STATS 0
+#define SYNC 0
+#define SYNC_SERIAL Serial1
+#define SYNC_BAUD 9600
+#define SYNC_SIMULATION 0
+#define HD_OUTPUT 1
+#define HD_BENCHMARK 0
+#define PREWARM_NEXT 1
+#define SWITCH_PROFILE 0
+#define FRAME_BUDGET 1
+#define BUDGET_STATS 0
+#define FAST_BOOT 1
 
 #include "util.h"
 #include "patterns.h"
+#include "clip.h"
+#include "golden.h"
+#include "soak.h"
+#include "control.h"
+#include "stream.h"
+#include "power.h"
+#include "sync.h"
+#include "syncsim.h"
+#include "apa102hd.h"
+#include "playlist.h"
+#include "budget.h"
+#include "cycles.h"
+#include "vm.h"
+#include "boot.h"
+#if CLIP_PLAYBACK
+// written by clip_compiler.py; emu.py clip records and compiles one on the host
+#include "clip_playback.h"
+#endif
 
 /* ---- Options ---- */
 // FIXME: should have options here for mounting, e.g. side-down vs. corner down, which strand is top/bottom, etc.
 // though changing these flags in the field is not very practical if it requires a recompile.
+// Shown with FAST_BOOT from power on until the first pattern has drawn
+const CRGB kBootColor = CRGB(24, 2, 10);
 /* ---- ------------*/
 
 CRGBArray<NUM_LEDS> leds;
@@ -23,6 +72,12 @@ Bits pinkBits(0);
 PinkFlash pinkFlash;
 Bits bitsPattern;
 SmoothPalettes smoothPalettes;
+// programs from vm_programs.h, plus whatever vm_asm.py uploads
+const VMProgram *vmPrograms[] = {&vmEmbers};
+VMPattern vmPattern(vmPrograms, ARRAY_SIZE(vmPrograms));
+#if CLIP_PLAYBACK
+ClipPattern clipPattern(clip_playback);
+#endif
 
 Pattern *idlePatterns[] = {
 //  &centerPulsePattern, // looks awful on small triangle
@@ -31,10 +86,21 @@ Pattern *idlePatterns[] = {
   &pinkFlash,
   &dropletsPattern,
   &bitsPattern,
-  &smoothPalettes
+  &smoothPalettes,
+  &vmPattern,
+#if CLIP_PLAYBACK
+  &clipPattern,
+#endif
   };
 const unsigned int kIdlePatternsCount = ARRAY_SIZE(idlePatterns);
 
+// Only one idle pattern runs at a time, plus any sub pattern it makes, so the arena only has to hold the largest such set
+static_assert(StandingWaves::kScratchBytes + Bits::kScratchBytes <= SCRATCH_ARENA_BYTES, "scratch arena too small for StandingWaves + Bits");
+// ...and with PREWARM_NEXT, the next one is prepared alongside it when the playlist finds the pair fits.
+// Droplets and Bits are the largest neighbours that should; VMPattern's worst case fits beside nothing that
+// borrows scratch, so the VM and the pattern after it set up when they start.
+static_assert(!PREWARM_NEXT || Droplets::kScratchBytes + Bits::kScratchBytes <= SCRATCH_ARENA_BYTES, "scratch arena too small to prepare Bits while Droplets runs");
+
 Pattern *activePattern = NULL;
 int activePatternIndex = -1;
 Pattern *lastPattern = NULL;
@@ -45,9 +111,52 @@ const int kIdlePatternTimeout = -1;//1000 * (kTestPatternTransitions ? 15 : 60 *
 
 Pattern *testIdlePattern = NULL;//&smoothPalettes;//&dropletsPattern;
 
+// Recorded at boot with CLIP_RECORD, for clip_compiler.py
+Pattern *clipRecordPattern = &smoothPalettes;
+const unsigned int kClipRecordSeconds = 10;
+const uint16_t kClipFrameMillis = 20;
+const uint16_t kClipSeed = 1337;
+
+// Deterministic capture of every pattern at boot, for golden.py
+Pattern *goldenPatterns[] = {&pinkBits, &pinkFlash, &dropletsPattern, &bitsPattern, &smoothPalettes, &standingWavesPattern};
+const unsigned int kGoldenFrames = 500;
+const uint16_t kGoldenFrameMillis = 5;
+const uint16_t kGoldenSeed = 1337;
+
+// Virtual milliseconds per loop() in the soak test, and how long before the millis() wrap it starts
+const uint32_t kSoakStepMillis = 50;
+const uint32_t kSoakMillisBeforeWrap = 10 * 60 * 1000;
+
+// Simulated group of pendants run at boot, to measure sync convergence and jitter
+const uint8_t kSyncSimPendants = 24;
+const uint32_t kSyncSimSeconds = 120;
+const uint16_t kSyncSimLatency = 8;
+const uint16_t kSyncSimJitter = 4;
+const uint8_t kSyncSimLossPercent = 5;
+const uint16_t kSyncSimSeed = 1337;
+
 /* ---------------------- */
 
 FrameCounter fc;
+ControlParser control;
+// bound the time spent on serial input per frame
+const unsigned int kControlBytesPerFrame = 64;
+
+FrameStream frameStream(leds);
+// patterns resume when the host stops sending frames for this long
+const unsigned long kStreamTimeout = 2000;
+PowerGovernor governor;
+APA102HDOutput hdOutput(16000000);
+Playlist playlist(idlePatterns, kIdlePatternsCount);
+FrameBudget frameBudget;
+uint32_t frameStartMicros = 0;
+#if SOAK_TEST
+SoakTest soak;
+#endif
+#if SYNC
+SerialTransport<HardwareSerial> syncTransport(SYNC_SERIAL, SYNC_BAUD);
+SyncNode pendantSync(&syncTransport, 0);
+#endif
 
 bool contactTouchDown = false;
 unsigned long touchDownStart = 0;
@@ -55,22 +164,162 @@ unsigned long touchDownStart = 0;
 uint8_t brightness = 127;
 uint8_t lastBrightnessPhase = 0;
 
-void setup() {
+bool serialStarted = false;
 
-  Serial.begin(57600);
+void startSerial() {
+  if (serialStarted) {
+    return;
+  }
+  serialStarted = true;
+  Serial.begin(SERIAL_BAUD);
   Serial.println("begin");
-  delay(200);
+}
+
+void reportPatternRam() {
+  logf("Pattern RAM (scratch arena %u bytes):", SCRATCH_ARENA_BYTES);
+  SCRATCH_REPORT(PinkFlash);
+  SCRATCH_REPORT(Bits);
+  SCRATCH_REPORT(StandingWaves);
+  SCRATCH_REPORT(Droplets);
+  SCRATCH_REPORT(SmoothPalettes);
+  SCRATCH_REPORT(VMPattern);
+}
 
+void seedRandom() {
   randomSeed(analogRead(UNCONNECTED_PIN));
   random16_add_entropy( analogRead(UNCONNECTED_PIN) );
+#if SYNC
+  pendantSync.nodeId = random16(SYNC_NO_LEADER);
+#endif
+}
 
+void startLeds() {
   FastLED.addLeds<APA102HD, 11, 13, BGR, DATA_RATE_MHZ(16)>(leds, NUM_LEDS);
   LEDS.setBrightness(brightness);
+}
+
+#if FAST_BOOT
+// entropy first: nothing that rolls dice starts before it
+const BootTask bootTasks[] = {seedRandom, startSerial, reportPatternRam};
+BootSequence boot(bootTasks, ARRAY_SIZE(bootTasks));
+#else
+BootSequence boot(NULL, 0);
+#endif
+
+// With FAST_BOOT, patterns and sync wait for the RNG to be seeded
+bool seeded() {
+#if FAST_BOOT
+  return boot.ran(seedRandom);
+#else
+  return true;
+#endif
+}
+
+void setup() {
+
+#if FAST_BOOT
+  // straight through FastLED's own driver: the HD output's tables aren't built yet
+  startLeds();
+  leds.fill_solid(kBootColor);
+  FastLED.show();
+  boot.frameShown(false);
+#if PALETTE_BENCHMARK || BITS_BENCHMARK || CYCLE_BENCHMARK || VM_BENCHMARK || HD_BENCHMARK || SYNC_SIMULATION || GOLDEN_CAPTURE || CLIP_RECORD
+  // these log from setup(), so serial can't wait for the first frames
+  startSerial();
+#endif
+#else
+  startSerial();
+  delay(200);
+  reportPatternRam();
+#endif
+
+#if PALETTE_BENCHMARK
+  benchmarkPaletteDecode();
+#endif
+
+#if BITS_BENCHMARK
+  benchmarkBitsPresets(leds);
+#endif
+
+#if CYCLE_BENCHMARK
+  benchmarkPatternCycles(leds);
+#endif
+
+#if VM_BENCHMARK
+  benchmarkVMPort(leds);
+#endif
+
+#if !FAST_BOOT
+  seedRandom();
+  startLeds();
+#endif
+#if SYNC
+  syncTransport.begin();
+#endif
+
+#if HD_OUTPUT || HD_BENCHMARK
+  hdOutput.begin();
+#endif
+#if HD_OUTPUT
+  // dim pixels lean on the HD output's dither, so the governor can't drop the rate below what it needs
+  governor.minFramerate = kHDDitherMinFramerate;
+#endif
+#if HD_BENCHMARK
+  benchmarkHDOutput(hdOutput, leds, NUM_LEDS);
+#endif
+
+  control.streamCommand = controlStreamFrame;
+  control.streamSink = &frameStream;
+
+#if SYNC_SIMULATION
+  runSyncSimulation(kSyncSimPendants, kSyncSimSeconds, kSyncSimLatency, kSyncSimJitter, kSyncSimLossPercent, kSyncSimSeed);
+#endif
+
+#if GOLDEN_CAPTURE
+  runGoldenCapture(goldenPatterns, ARRAY_SIZE(goldenPatterns), leds, kGoldenFrames, kGoldenFrameMillis, kGoldenSeed);
+#endif
+
+#if CLIP_RECORD
+  recordClip(clipRecordPattern, leds, kClipRecordSeconds, kClipFrameMillis, kClipSeed);
+#endif
+
+#if SOAK_TEST
+  soak.begin(kSoakStepMillis, kSoakMillisBeforeWrap);
+#endif
 
   fc.tick();
 }
 
+void selectPattern(unsigned int index, int variant) {
+  if (activePattern) {
+    activePattern->stop();
+    lastPattern = activePattern;
+  }
+  playlist.cancel();
+  activePatternIndex = index;
+  activePattern = idlePatterns[index];
+  activePattern->setVariant(variant);
+  playlist.switching(activePattern);
+  activePattern->start();
+}
+
+#if SYNC
+// Starts the pattern the pendants agreed on, from the same RNG seed so they make the same choices
+void startSyncedPattern() {
+  random16_set_seed(pendantSync.seed);
+  randomSeed(pendantSync.seed);
+  selectPattern(pendantSync.pattern % kIdlePatternsCount, -1);
+}
+#endif
+
 void nextPattern() {
+#if SYNC
+  // every pendant runs what the leader picks, so a tap on a follower asks the leader for the next pattern
+  if (pendantSync.setPattern((activePatternIndex + 1) % kIdlePatternsCount, random16()) || activePattern == NULL) {
+    startSyncedPattern();
+  }
+  return;
+#endif
   if (testIdlePattern != NULL) {
     activePattern = testIdlePattern;
   } else {
@@ -80,34 +329,185 @@ void nextPattern() {
       activePattern = NULL;
     }
     activePattern = idlePatterns[++activePatternIndex % kIdlePatternsCount];
+    activePattern->setVariant(-1);
   }
   if (!activePattern->isRunning()) {
+    playlist.switching(activePattern);
     activePattern->start();
   }
 }
 
-void loop() {
-  for (unsigned i = 0; i < kIdlePatternsCount; ++i) {
-    Pattern *pattern = idlePatterns[i];
-    if (pattern->isRunning()) {
-      pattern->loop(leds);
-    }
-  }
+int readTouch() {
+#if SOAK_TEST
+  return soak.touchValue();
+#else
+  return touchRead(TOUCH_PIN);
+#endif
+}
 
-  // clear out patterns that have stopped themselves
-  if (activePattern != NULL && !activePattern->isRunning()) {
-    logf("Clearing inactive pattern %s", activePattern->description());
+// The rate this frame is meant to run at
+uint16_t targetFramerate() {
+#if POWER_GOVERNOR && !SOAK_TEST
+  return governor.framerate;
+#else
+  return MAX_FRAMERATE;
+#endif
+}
+
+// Time left in this frame before the next one is due
+int32_t frameSlackMicros() {
+#if POWER_GOVERNOR && !SOAK_TEST
+  return governor.slackMicros();
+#else
+  return 1000000 / MAX_FRAMERATE - (int32_t)(micros() - frameStartMicros);
+#endif
+}
+
+void showLeds(CRGB *frame) {
+#if HD_OUTPUT
+  hdOutput.show(frame, NUM_LEDS, FastLED.getBrightness());
+#else
+  // FastLED shows the buffer it was last given, and streaming alternates between two
+  FastLED[0].setLeds(frame, NUM_LEDS);
+  FastLED.show();
+#endif
+}
+
+void startStreaming() {
+  logf("Streaming frames from host");
+  if (activePattern) {
+    activePattern->stop();
+    lastPattern = activePattern;
     activePattern = NULL;
   }
+  frameStream.active = true;
+}
 
-  // time out idle patterns
-  if (activePattern != NULL && activePattern->isRunning() && (kIdlePatternTimeout != -1 && activePattern->runTime() > kIdlePatternTimeout)) {
-    if (activePattern != testIdlePattern && activePattern->wantsToIdleStop()) {
+void stopStreaming() {
+  if (frameStream.active) {
+    logf("Stopped streaming after %lu frames", frameStream.framesShown);
+    frameStream.active = false;
+    frameStream.framesShown = 0;
+    frameStream.reset();
+  }
+}
+
+void handleControlFrame() {
+  if (!control.crcOK) {
+    if (control.command == controlStreamFrame) {
+      frameStream.reject();
+    }
+    sendControlNak(control.command, controlErrorBadCrc);
+    return;
+  }
+  switch (control.command) {
+    case controlPing:
+      break;
+    case controlSelectPattern:
+      if (control.length < 1 || control.u8(0) >= kIdlePatternsCount) {
+        sendControlNak(control.command, controlErrorBadPayload);
+        return;
+      }
+      selectPattern(control.u8(0), control.length >= 3 ? control.i16(1) : -1);
+      break;
+    case controlNextPattern:
       nextPattern();
+      break;
+    case controlSetBrightness:
+      if (control.length < 1) {
+        sendControlNak(control.command, controlErrorBadPayload);
+        return;
+      }
+      brightness = control.u8(0);
+      LEDS.setBrightness(brightness);
+      break;
+    case controlSetParameter:
+      if (control.length < 3) {
+        sendControlNak(control.command, controlErrorBadPayload);
+        return;
+      }
+      if (!activePattern || !activePattern->setParameter(control.u8(0), control.i16(1))) {
+        sendControlNak(control.command, controlErrorRejected);
+        return;
+      }
+      break;
+    case controlStreamFrame: {
+      if (!frameStream.commit()) {
+        sendControlNak(control.command, controlErrorBadPayload);
+        return;
+      }
+      if (!frameStream.active) {
+        startStreaming();
+      }
+      showLeds(frameStream.shown());
+      ++frameStream.framesShown;
+      frameStream.lastFrameMillis = millis();
+      uint16_t micro = micros() - frameStream.frameStartMicros;
+      uint8_t reply[3] = {frameStream.seq, (uint8_t)(micro & 0xFF), (uint8_t)(micro >> 8)};
+      sendControlFrame(control.command | CONTROL_REPLY, reply, sizeof(reply));
+      return;
+    }
+    case controlLoadProgram: {
+      if (control.length < 1) {
+        sendControlNak(control.command, controlErrorBadPayload);
+        return;
+      }
+      uint8_t flags = control.u8(0);
+      if (!vmPattern.receive(control.payload + 1, control.length - 1, flags & controlChunkFirst, flags & controlChunkLast)) {
+        sendControlNak(control.command, controlErrorRejected);
+        return;
+      }
+      if (flags & controlChunkLast) {
+        for (unsigned int i = 0; i < kIdlePatternsCount; ++i) {
+          if (idlePatterns[i] == &vmPattern) {
+            selectPattern(i, vmPattern.variantCount() - 1);
+          }
+        }
+      }
+      break;
     }
+    case controlStreamEnd:
+      stopStreaming();
+      break;
+    case controlQueryStats: {
+      ControlStats stats;
+      stats.uptimeMillis = millis();
+      stats.framerateTimes10 = fc.framerate * 10;
+      stats.patternIndex = (activePatternIndex < 0 ? 0xFF : activePatternIndex % kIdlePatternsCount);
+      stats.variant = activePattern ? activePattern->getVariant() : -1;
+      stats.brightness = brightness;
+      stats.scratchInUse = gScratch.bytesInUse();
+      stats.scratchHighWater = gScratch.highWaterMark();
+      stats.framesReceived = control.framesReceived;
+      stats.framesRejected = control.framesRejected;
+      stats.framerate = governor.framerate;
+      stats.awakePermille = governor.dutyCycle * 1000;
+      stats.estimatedMilliamps = governor.estimatedMilliamps();
+      stats.batteryMinutes = min(governor.batteryHours() * 60, 0xFFFF);
+      sendControlFrame(control.command | CONTROL_REPLY, &stats, sizeof(stats));
+      return;
+    }
+    default:
+      sendControlNak(control.command, controlErrorUnknownCommand);
+      return;
   }
+  sendControlFrame(control.command | CONTROL_REPLY, NULL, 0);
+}
 
-  int readVal = touchRead(TOUCH_PIN);
+void pollControl(unsigned int maxBytes) {
+  for (unsigned int i = 0; i < maxBytes && Serial.available() > 0; ++i) {
+    if (control.feed(Serial.read())) {
+      handleControlFrame();
+    }
+  }
+  if (Serial.available() <= 0) {
+    control.idle();
+  }
+}
+
+// A tap moves to the next pattern (or back to the patterns from streaming); a hold fades the brightness
+void handleTouch() {
+  int readVal = readTouch();
 //  for (int x = 0; x < readVal / 100; ++x) {
 //    if (x > 0 && x < NUM_LEDS) {
 //      leds[x] = CRGB(0,0xFF, 0);
@@ -116,11 +516,11 @@ void loop() {
 
   if (readVal > 800) {
     if (!contactTouchDown) {
-      touchDownStart = millis();
+      touchDownStart = gClock.millis();
     }
     contactTouchDown = true;
   }
-  unsigned long touchDownDuration = millis() - touchDownStart;
+  unsigned long touchDownDuration = gClock.millis() - touchDownStart;
   const int brightnessFaderDelay = 500;
   if (contactTouchDown) {
     uint8_t phase = (touchDownDuration - brightnessFaderDelay) * 256 / 4000 + lastBrightnessPhase;
@@ -129,23 +529,120 @@ void loop() {
       LEDS.setBrightness(brightness);
     }
     
-    if (touchRead(TOUCH_PIN) < 500) {
+    if (readTouch() < 500) {
       contactTouchDown = false;
       if (touchDownDuration < brightnessFaderDelay) {
-        nextPattern();
+        if (frameStream.active) {
+          stopStreaming();
+        } else {
+          nextPattern();
+        }
       } else {
         lastBrightnessPhase = phase % 0x100;
       }
     }
   }
+}
+
+// Counts the frame and waits until the next one is due
+void finishFrame() {
+  fc.tick();
+#if SOAK_TEST
+  soak.frameCompleted(activePattern);
+#elif POWER_GOVERNOR
+  governor.frameCompleted(activePattern, frameStream.active ? frameStream.shown() : leds, NUM_LEDS, brightness, contactTouchDown);
+#else
+  fc.clampToFramerate(MAX_FRAMERATE);
+#endif
+}
+
+void loop() {
+  // while the host is streaming, its frames are the only thing drawn, shown as they are decoded.
+  // Touch still works, and the governor still paces the frames and counts their current.
+  if (frameStream.active) {
+    pollControl(-1);
+    if (millis() - frameStream.lastFrameMillis > kStreamTimeout) {
+      stopStreaming();
+    }
+    handleTouch();
+    finishFrame();
+    return;
+  }
+  frameStartMicros = micros();
+
+#if SYNC
+  // the node id comes from the RNG
+  if (seeded()) {
+    uint32_t localMillis = millis();
+    bool syncedPatternChanged = pendantSync.poll(localMillis);
+    gClock.setOffset(pendantSync.millis(localMillis) - localMillis);
+    if (syncedPatternChanged) {
+      startSyncedPattern();
+    }
+  }
+#endif
+
+  for (unsigned i = 0; i < kIdlePatternsCount; ++i) {
+    Pattern *pattern = idlePatterns[i];
+    if (pattern->isRunning()) {
+      pattern->loop(leds);
+    }
+  }
+
+  // clear out patterns that have stopped themselves
+  if (activePattern != NULL && !activePattern->isRunning()) {
+    logf("Clearing inactive pattern %s", activePattern->description());
+    activePattern = NULL;
+  }
+
+  // time out idle patterns
+  if (activePattern != NULL && activePattern->isRunning() && (kIdlePatternTimeout != -1 && activePattern->runTime() > (uint32_t)kIdlePatternTimeout)) {
+    if (activePattern != testIdlePattern && activePattern->wantsToIdleStop()) {
+      nextPattern();
+    }
+  }
+
+  pollControl(kControlBytesPerFrame);
+
+  handleTouch();
 
   // start a new idle pattern
-  if (activePattern == NULL) {
+  if (activePattern == NULL && seeded()) {
     nextPattern();
   }
 
-  FastLED.show();
+  showLeds(leds);
+  boot.frameShown(activePattern != NULL);
 
-  fc.tick();
-  fc.clampToFramerate(400);
+#if HD_BENCHMARK
+  EVERY_N_SECONDS(10) {
+    logf("HD output: encode %.1f us, SPI write %.1f us per frame", hdOutput.encodeMicros / (float)hdOutput.frames, hdOutput.writeMicros / (float)hdOutput.frames);
+    hdOutput.frames = hdOutput.encodeMicros = hdOutput.writeMicros = 0;
+  }
+#endif
+
+#if HSV_STATS
+  static unsigned long hsvStatsFrames = 0;
+  ++hsvStatsFrames;
+  EVERY_N_SECONDS(10) {
+    gHueRing.logStats(hsvStatsFrames);
+    hsvStatsFrames = 0;
+  }
+#endif
+
+  uint32_t busyMicros = micros() - frameStartMicros;
+  playlist.frameCompleted(busyMicros);
+#if FRAME_BUDGET
+  frameBudget.frameCompleted(activePattern, busyMicros, targetFramerate());
+#endif
+  boot.useSlack(frameSlackMicros());
+#if PREWARM_NEXT && !SYNC
+  // SYNC starts patterns from the leader's RNG seed, so nothing may be picked ahead of that. Nor before
+  // FAST_BOOT has seeded the RNG, or the first pattern's picks would be the same every power on.
+  if (testIdlePattern == NULL && seeded()) {
+    playlist.useSlack(activePatternIndex, frameSlackMicros());
+  }
+#endif
+
+  finishFrame();
 }
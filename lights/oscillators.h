@@ -0,0 +1,158 @@
+#ifndef OSCILLATORS_H
+#define OSCILLATORS_H
+
+#include <FastLED.h>
+#include "util.h"
+
+// Shared bank of low-frequency oscillators. Patterns add the ones they need as they start and read them with
+// value(); tick() moves every phase accumulator on by the elapsed time once per frame, and each value is
+// worked out at most once per frame, on its first read. Phases count in beat16 units from the same
+// timebase FastLED's beat functions use (with the same wraparound), so oscSine gives exactly what
+// beatsin88()/beatsin16() would and oscSine8 what beatsin8() would.
+//
+// Oscillators can be retuned live over the control protocol's set parameter command, with ids
+//   OSC_PARAMETER_BASE + 4 * n + field
+// for the pattern's nth oscillator (in the order it added them), where field is
+//   0 rate in bpm88 (negative runs backwards), 1 low, 2 high, 3 shape
+#define OSC_MAX 12
+#define OSC_PARAMETER_BASE 0x80
+#define OSC_PARAMETER_FIELDS 4
+
+enum OscShape : uint8_t {
+  oscSine, oscSine8, oscTriangle, oscSaw, oscShapeCount
+};
+
+class OscillatorBank {
+  private:
+    struct Oscillator {
+      const void *owner;
+      // beat16 << 16, and how far it moves per millisecond
+      uint32_t phase;
+      int32_t increment;
+      uint16_t phaseOffset;
+      uint16_t low;
+      uint16_t high;
+      uint16_t value;
+      OscShape shape;
+      bool stale;
+    } oscillators[OSC_MAX] = {};
+    uint32_t lastMillis = 0;
+
+  public:
+    // Returns a handle for value(), or -1 if the bank is full.
+    // bpm88 is beats per minute in 8.8 fixed point, as for beatsin88(); FastLED's beatsin8() and beatsin16()
+    // take whole beats per minute below 256, which is bpm88 >> 8.
+    int8_t add(const void *owner, OscShape shape, int32_t bpm88, uint16_t low, uint16_t high,
+               uint16_t phaseOffset = 0, uint32_t timebase = 0) {
+      for (int8_t i = 0; i < OSC_MAX; ++i) {
+        Oscillator &osc = oscillators[i];
+        if (osc.owner) {
+          continue;
+        }
+        osc.owner = owner;
+        osc.shape = shape;
+        osc.increment = bpm88 * 280;
+        // phase as of the last tick; the next one brings it up to date
+        osc.phase = (lastMillis - timebase) * (uint32_t)osc.increment;
+        osc.phaseOffset = phaseOffset;
+        osc.low = low;
+        osc.high = high;
+        osc.stale = true;
+        return i;
+      }
+      logf("ERROR: oscillator bank full");
+      return -1;
+    }
+
+    void release(const void *owner) {
+      for (uint8_t i = 0; i < OSC_MAX; ++i) {
+        if (oscillators[i].owner == owner) {
+          oscillators[i].owner = NULL;
+        }
+      }
+    }
+
+    // Advances every oscillator to now. Calling it again in the same millisecond does nothing.
+    void tick(uint32_t now) {
+      uint32_t elapsed = now - lastMillis;
+      if (elapsed == 0) {
+        return;
+      }
+      lastMillis = now;
+      for (uint8_t i = 0; i < OSC_MAX; ++i) {
+        Oscillator &osc = oscillators[i];
+        if (osc.owner) {
+          osc.phase += elapsed * (uint32_t)osc.increment;
+          osc.stale = true;
+        }
+      }
+    }
+
+    uint16_t value(int8_t handle) {
+      if (handle < 0) {
+        return 0;
+      }
+      Oscillator &osc = oscillators[handle];
+      if (osc.stale) {
+        osc.value = evaluate(osc);
+        osc.stale = false;
+      }
+      return osc.value;
+    }
+
+    // Applies a parameter id from OSC_PARAMETER_BASE up to owner's oscillators. Returns false if the id
+    // doesn't name one of them.
+    bool setParameter(const void *owner, uint8_t id, int16_t value) {
+      if (id < OSC_PARAMETER_BASE) {
+        return false;
+      }
+      uint8_t nth = (id - OSC_PARAMETER_BASE) / OSC_PARAMETER_FIELDS;
+      for (uint8_t i = 0; i < OSC_MAX; ++i) {
+        Oscillator &osc = oscillators[i];
+        if (osc.owner != owner || nth-- > 0) {
+          continue;
+        }
+        switch ((id - OSC_PARAMETER_BASE) % OSC_PARAMETER_FIELDS) {
+          case 0:
+            osc.increment = value * 280;
+            break;
+          case 1:
+            osc.low = value;
+            break;
+          case 2:
+            osc.high = value;
+            break;
+          case 3:
+            if ((uint16_t)value >= oscShapeCount) {
+              return false;
+            }
+            osc.shape = (OscShape)value;
+            break;
+        }
+        osc.stale = true;
+        return true;
+      }
+      return false;
+    }
+
+  private:
+    static uint16_t evaluate(const Oscillator &osc) {
+      uint16_t beat = (osc.phase >> 16) + osc.phaseOffset;
+      uint16_t range = osc.high - osc.low;
+      switch (osc.shape) {
+        case oscSine8:
+          return (uint8_t)(osc.low + scale8(sin8(beat >> 8), range));
+        case oscTriangle:
+          return osc.low + scale16((uint16_t)(beat & 0x8000 ? ~(beat << 1) : beat << 1), range);
+        case oscSaw:
+          return osc.low + scale16(beat, range);
+        case oscSine:
+        default:
+          return osc.low + scale16(sin16(beat) + 32768, range);
+      }
+    }
+};
+
+OscillatorBank gOscillators;
+
+#endif
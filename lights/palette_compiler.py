@@ -0,0 +1,86 @@
+#!/usr/bin/env python3
+# Packs the gradient palettes in palettes.h into the compact table in palettes_packed.h.
+#
+# Format:
+#   gPackedPaletteData     per unique palette: anchor count, delta-coded anchor positions
+#                          (first is always 0 and last always 255, so only the middle ones are stored),
+#                          then the r, g, b of each anchor
+#   gPackedPaletteOffsets  start of each gGradientPalettes entry in gPackedPaletteData;
+#                          identical palettes share one entry
+#
+# A shared anchor color table was tried too, but only ~10% of anchor colors repeat in the current set
+# and the per-anchor index byte cost more than the dedupe saved, so colors are stored inline.
+#
+# Rerun after editing palettes.h:
+#   ./palette_compiler.py [palettes.h] [palettes_packed.h]
+import os
+import re
+import sys
+
+os.chdir(os.path.dirname(os.path.realpath(__file__)))
+
+src_path = sys.argv[1] if len(sys.argv) > 1 else "palettes.h"
+dst_path = sys.argv[2] if len(sys.argv) > 2 else "palettes_packed.h"
+
+source = open(src_path).read()
+source_no_comments = re.sub(r"//[^\n]*", "", source)
+
+palettes = {}
+for match in re.finditer(r"DEFINE_GRADIENT_PALETTE\(\s*(\w+)\s*\)\s*\{([^}]*)\}", source_no_comments):
+	name = match.group(1)
+	values = [int(v) for v in re.findall(r"\d+", match.group(2))]
+	assert len(values) % 4 == 0, "palette {} is not a list of (index, r, g, b)".format(name)
+	anchors = [tuple(values[i:i + 4]) for i in range(0, len(values), 4)]
+	assert anchors[0][0] == 0 and anchors[-1][0] == 255, "palette {} must span 0..255".format(name)
+	palettes[name] = anchors
+
+playlist_match = re.search(r"gGradientPalettes\[\]\s*=\s*\{([^}]*)\}", source_no_comments)
+playlist = re.findall(r"\w+", playlist_match.group(1))
+
+data = []
+offsets = []
+packed_offset_for = {}
+
+for name in playlist:
+	anchors = palettes[name]
+	key = tuple(anchors)
+	if key in packed_offset_for:
+		offsets.append(packed_offset_for[key])
+		continue
+	packed_offset_for[key] = len(data)
+	offsets.append(len(data))
+
+	data.append(len(anchors))
+	for prev, anchor in zip(anchors[:-2], anchors[1:-1]):
+		data.append(anchor[0] - prev[0])
+	for anchor in anchors:
+		data.extend(anchor[1:])
+
+assert len(data) <= 0xFFFF
+
+# gGradientPalettes holds 32-bit pointers on the Teensy
+original_bytes = sum(4 * len(palettes[name]) for name in set(playlist)) + 4 * len(playlist)
+packed_bytes = len(data) + 2 * len(offsets)
+
+def byte_rows(values, per_row):
+	rows = []
+	for i in range(0, len(values), per_row):
+		rows.append("  " + ", ".join("{:3}".format(v) for v in values[i:i + per_row]) + ",")
+	return "\n".join(rows)
+
+with open(dst_path, "w") as out:
+	out.write("// Generated by palette_compiler.py from {} -- do not edit.\n".format(os.path.basename(src_path)))
+	out.write("//\n")
+	out.write("// {} palettes ({} unique).\n".format(len(playlist), len(packed_offset_for)))
+	out.write("// {} bytes of PROGMEM packed vs. {} bytes as gradient palettes + pointer table.\n".format(packed_bytes, original_bytes))
+	out.write("\n#ifndef PALETTES_PACKED_H\n#define PALETTES_PACKED_H\n\n")
+	out.write("const uint8_t gPackedPaletteCount = {};\n\n".format(len(playlist)))
+	out.write("const uint8_t gPackedPaletteData[] PROGMEM = {\n")
+	out.write(byte_rows(data, 16))
+	out.write("\n};\n\n")
+	out.write("const uint16_t gPackedPaletteOffsets[] PROGMEM = {\n")
+	out.write(byte_rows(offsets, 12))
+	out.write("\n};\n\n#endif\n")
+
+print("{} palettes ({} unique)".format(len(playlist), len(packed_offset_for)))
+print("flash: {} bytes packed vs {} bytes original ({:.0f}%)".format(packed_bytes, original_bytes, 100.0 * packed_bytes / original_bytes))
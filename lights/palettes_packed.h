@@ -0,0 +1,76 @@
+// Generated by palette_compiler.py from palettes.h -- do not edit.
+//
+// 33 palettes (33 unique).
+// 949 bytes of PROGMEM packed vs. 1048 bytes as gradient palettes + pointer table.
+
+#ifndef PALETTES_PACKED_H
+#define PALETTES_PACKED_H
+
+const uint8_t gPackedPaletteCount = 33;
+
+const uint8_t gPackedPaletteData[] PROGMEM = {
+    7,  22,  29,  34,  50,  63, 120,   0,   0, 179,  22,   0, 255, 104,   0, 167,
+   22,  18, 100,   0, 103,  16,   0, 130,   0,   0, 160,   5, 101,  64,  77,   1,
+   14,   5,  16,  36,  14,  56,  68,  30, 150, 156,  99, 150, 156,  99,   4,  89,
+   64,   1,   6,   7,   1,  99, 111, 144, 209, 255,   0,  73,  82,   9,  31,  32,
+   32,  32,  32,  32,  32,   4,   1,  31,  55,   1,  16, 197,   3,   7,  59,   2,
+   17,   6,   2,  34,  39,   6,  33, 112,  13,  32,  56,   9,  35,  22,   6,  38,
+    2, 188, 135,   1,  46,   7,   1,   5,  63,  64,  64,   3,   0, 255,  23,   0,
+  255,  67,   0, 255, 142,   0,  45, 255,   0,   0,   5, 127,  48,  46, 126,  11,
+  255, 197,   1,  22, 210, 157, 172, 157,   3, 112, 157,   3, 112,   6,  50,  46,
+    0,  43,  40, 199, 197,  10, 152, 155,   1, 111, 120,  43, 127, 162,  10,  73,
+  111,   1,  34,  71,   6,  51,  50,   3,  74, 100, 156, 153,   1,  99, 137,   1,
+   68,  84,  35, 142, 168,   0,  63, 117,   1,  10,  10,   7,  61,  40,  26,  26,
+   40, 229,   1,   1, 242,   4,  63, 255,  12, 255, 249,  81, 252, 255,  11, 235,
+  244,   5,  68, 232,   1,   5,   8,  51,  25,  25,  26,  26,  76,   4,   1,   1,
+   16,   0,   1,  97, 104,   3, 255, 131,  19,  67,   9,   4,  16,   0,   1,   4,
+    1,   1,   4,   1,   1,  12,  42,  21,  21,  22,  10,  22,  10,  22,  21,  21,
+    8,   3,   0,  23,   7,   0,  75,  38,   6, 169,  99,  38, 213, 169, 119, 255,
+  255, 255, 135, 255, 138,  22, 255,  24,   0, 255,   0,   0, 136,   0,   0,  55,
+    0,   0,  55,   0,   9,  37,  39,  51,   1,   2,  23,  51,   0,   0,   0,   2,
+   25,   1,  15, 115,   5,  79, 213,   1, 126, 211,  47, 188, 209, 247, 144, 182,
+  205,  59, 117, 250,   1,  37, 192,   6,  19,  19,  25,   3,   1,   5,   0,  32,
+   23,   1, 161,  55,   1, 229, 144,   1,  39, 142,  74,   1,   4,   1,   7,  43,
+   43,  41,  43,  39, 255,  33,   4, 255,  68,  25, 255,   7,  25, 255,  82, 103,
+  255, 255, 242,  42, 255,  22,  87, 255,  65,   6,  48,  41,  71,  56, 247, 176,
+  247, 255, 136, 255, 220,  29, 226,   7,  82, 178,   1, 124, 109,   1, 124, 109,
+    8,  66,  38,  26,  20,  51,  38,   1, 124, 109,   1,  93,  79,  52,  65,   1,
+  115, 127,   1,  52,  65,   1,   1,  86,  72,   0,  55,  45,   0,  55,  45,   7,
+   42,  42,  43,  43,  42,  47,  30,   2, 213, 147,  24, 103, 219,  52,   3, 219,
+  207,   1,  48, 214,   1,   1, 111,   1,   7,  33,   4,  94,  38, 194,   1,   1,
+    1,  29,  18,  57, 131,  28, 113,   1,   1,   5,  53,  51,  49,   2,   1,   1,
+   18,   1,   0,  69,  29,   1, 167, 135,  10,  46,  56,   4,   6,  72,  17,  18,
+   34, 113,  91, 147, 157,  88,  78, 208,  85,  33, 255,  29,  11, 137,  31,  39,
+   59,  33,  89,   5,  63,  64,  64,  43,   3, 153, 100,   4, 103, 188,   5,  66,
+  161,  11, 115, 135,  20, 182,   4, 101,  77,  97, 255,   1,  47, 133,   1,  13,
+   43,   1,   2,  10,   1,  13,  46,  50,  12,  11,  27,  28,  14,  14,  16,  16,
+   10,   0,   0,   0,  18,   0,   0, 113,   0,   0, 142,   3,   1, 175,  17,   1,
+  213,  44,   2, 255,  82,   4, 255, 115,   4, 255, 156,   4, 255, 203,   4, 255,
+  255,   4, 255, 255,  71, 255, 255, 255,   7,  76,  70,  51,  43,  10,   1,   1,
+    0,  32,   5,   0, 192,  24,   0, 220, 105,   5, 252, 255,  31, 252, 255, 111,
+  255, 255, 255,  11,  25,  35,  33,  13,   3,   4,   3,   8,  44,  10,  85,   5,
+   29, 109,  18,  59, 138,  42,  83,  99,  52, 110,  66,  64, 123,  49,  65, 139,
+   35,  66, 192, 117,  98, 255, 255, 137, 100, 180, 155,  22, 121, 174,   7,  31,
+   32,   7,   6,  32,  71,  27,  39, 130,  11,  51, 213,   2,  64, 232,   1,  66,
+  252,   1,  69, 123,   2,  51,  46,   9,  35,  11,  25,  26,  25,  26,   7,   5,
+    8,  27,  34,  19,   2,  39,  26,   4,  45,  33,   6,  52,  68,  62, 125, 118,
+  187, 240, 163, 215, 247, 217, 244, 255, 159, 149, 221, 113,  78, 188, 128,  57,
+  155, 146,  40, 123,  13,  51,  33,  20,   8,  10,   2,  11,   7,  21,  41,  45,
+   26,   1,   1,  67,   4,   1, 118,  14,   1, 137, 152,  52, 113,  65,   1, 133,
+  149,  59, 137, 152,  52, 113,  65,   1, 139, 154,  46, 113,  13,   1,  55,   3,
+    1,  17,   1,   1,  17,   1,   1,   7,  42,  42,  43,  43,  42,   0,   0,   0,
+    0,   0,  45,   0,   0, 255,  42,   0, 255, 255,   0, 255, 255,  55, 255, 255,
+  255, 255,   5,  63,  64,  64,   0,   0,   0,  42,   0,  45, 255,   0, 255, 255,
+    0,  45, 255,   0,   0,   7,  42,  42,  43,  43,  42,   0,   0,   0,  42,   0,
+    0, 255,   0,   0, 255,   0,  45, 255,   0, 255, 255,  55,  45, 255, 255,   0,
+    5,  63,  64,  64,   0,   0, 255,   0,  55, 255,   0, 255, 255,  42, 255,  45,
+  255, 255,   0,
+};
+
+const uint16_t gPackedPaletteOffsets[] PROGMEM = {
+    0,  27,  46,  61,  96, 103, 122, 141, 164, 187, 214, 245,
+  292, 327, 350, 377, 400, 431, 458, 473, 492, 515, 534, 549,
+  600, 627, 670, 697, 740, 791, 818, 837, 864,
+};
+
+#endif
@@ -3,26 +3,64 @@
 
 #include <FastLED.h>
 #include "util.h"
-#include "palettes.h"
+#include "scratch.h"
+#include "gradients.h"
+#include "huering.h"
+#include "oscillators.h"
+#include "indexed.h"
 
 class Pattern {
+  public:
+    // Peak scratch arena use while running; subclasses that borrow scratch override this
+    static const size_t kScratchBytes = 0;
+
   protected:
-    long startTime = -1;
-    long stopTime = -1;
+    // millis() when started and stopped; whether the pattern runs is kept apart, since every
+    // millis() value, 0xFFFFFFFF (-1 as a long) included, is a real start time after a few weeks
+    uint32_t startTime = 0;
+    uint32_t stopTime = 0;
+    bool running = false;
     Pattern *subPattern = NULL;
+    int variant = -1;
+    bool prepared = false;
+    // set by the frame budget governor (see budget.h): 0 is full quality
+    uint8_t quality = 0;
+    uint32_t updateMicros = 0;
+    uint32_t subPatternMicros = 0;
 
     virtual void stopCompleted() {
       if (!readyToStop()) {
         logf("WARNING: stopped %s before subPattern was stopped", description());
       }
       logf("Stopped %s", description());
-      stopTime = -1;
-      startTime = -1;
+      running = false;
       if (subPattern) {
         subPattern->stop();
         delete subPattern;
         subPattern = NULL;
       }
+      gScratch.giveBack(this);
+      gOscillators.release(this);
+      scratchReturned();
+    }
+
+    // Called when the scratch has been handed back, on stopping or when a prepare() is thrown away.
+    // Patterns that borrow scratch drop their pointers into it here.
+    virtual void scratchReturned() { }
+
+    // Working memory that lives only while the pattern runs (or is prepared). Borrow it in preload() or setup().
+    template<typename T>
+    T *borrowScratch(size_t count = 1) {
+      return gScratch.borrow<T>(this, count);
+    }
+
+    // An LFO from the shared bank (see oscillators.h), released when the pattern stops. Add them in preload() or setup().
+    int8_t addOscillator(OscShape shape, int32_t bpm88, uint16_t low, uint16_t high, uint16_t phaseOffset = 0, uint32_t timebase = 0) {
+      return gOscillators.add(this, shape, bpm88, low, high, phaseOffset, timebase);
+    }
+
+    uint16_t oscillator(int8_t handle) {
+      return gOscillators.value(handle);
     }
 
     virtual Pattern *makeSubPattern() {
@@ -36,34 +74,143 @@ class Pattern {
   public:
     virtual ~Pattern() { }
 
+    // The part of starting that doesn't depend on the start time: preload(), and making and preparing
+    // the sub pattern. The playlist calls it in slack time ahead of a switch; start() does if nobody did.
+    void prepare() {
+      if (prepared) {
+        return;
+      }
+      prepared = true;
+      preload();
+      subPattern = makeSubPattern();
+      if (subPattern) {
+        subPattern->prepare();
+      }
+    }
+
+    // Throws away a prepare() that start() isn't going to use
+    void unprepare() {
+      if (!prepared || isRunning()) {
+        return;
+      }
+      prepared = false;
+      if (subPattern) {
+        subPattern->unprepare();
+        delete subPattern;
+        subPattern = NULL;
+      }
+      gScratch.giveBack(this);
+      gOscillators.release(this);
+      scratchReturned();
+    }
+
+    bool isPrepared() {
+      return prepared;
+    }
+
+    // The class's kScratchBytes, for the playlist to check the next pattern fits beside the running one
+    virtual size_t scratchBytes() {
+      return kScratchBytes;
+    }
+
     void start() {
       logf("Starting %s", description());
-      startTime = millis();
-      stopTime = -1;
+      startTime = gClock.millis();
+      running = true;
+      quality = 0;
+      prepare();
       setup();
-      subPattern = makeSubPattern();
       if (subPattern) {
         subPattern->start();
       }
+      prepared = false;
     }
 
     void loop(CRGBArray<NUM_LEDS> &leds) {
+      gOscillators.tick(gClock.millis());
+      uint32_t start = micros();
       update(leds);
+      uint32_t updated = micros();
+      updateMicros = updated - start;
       if (subPattern) {
         subPattern->update(leds);
+        subPatternMicros = micros() - updated;
+      }
+    }
+
+    // Cost of the last loop()'s update(), and of the sub pattern's
+    uint32_t lastUpdateMicros() {
+      return updateMicros;
+    }
+
+    uint32_t lastSubPatternMicros() {
+      return subPattern ? subPatternMicros : 0;
+    }
+
+    // Patterns that can draw more cheaply when the frame is over budget have more than one quality
+    // level, and read quality in update(). Each level above 0 gives up a little more of the look.
+    virtual uint8_t qualityLevels() {
+      return 1;
+    }
+
+    // Levels past the pattern's last mean its lowest quality. The sub pattern follows along.
+    void setQuality(uint8_t level) {
+      quality = min(level, qualityLevels() - 1);
+      if (subPattern) {
+        subPattern->setQuality(level);
       }
     }
 
+    // Setup work that doesn't depend on the start time (picking presets and palettes, borrowing scratch
+    // and decoding into it), so it can run well before start()
+    virtual void preload() { }
+
     virtual void setup() { }
 
+    // Variants name every look a pattern can pick (presets, palettes), for controlSelectPattern and VM uploads.
+    // -1 means pick at random in preload(), as usual.
+    virtual uint16_t variantCount() {
+      return 1;
+    }
+
+    void setVariant(int variant) {
+      if (variant != this->variant) {
+        unprepare();
+      }
+      this->variant = variant;
+    }
+
+    int getVariant() {
+      return variant;
+    }
+
+    // Live parameter changes from the control protocol. Returns false if the id isn't one this pattern has.
+    // Ids from OSC_PARAMETER_BASE up retune the pattern's oscillators.
+    virtual bool setParameter(uint8_t id, int16_t value) {
+      return gOscillators.setParameter(this, id, value);
+    }
+
     virtual bool wantsToIdleStop() {
       return true;
     }
 
+    // Lowest frame rate at which the pattern's motion stays smooth. Patterns that move by elapsed time
+    // (or step per-frame fades and dice with FrameSteps) look the same at lower rates, only choppier,
+    // which is what the power governor trades for current when the brightness is turned down.
+    virtual uint16_t motionFramerate() {
+      return MAX_FRAMERATE;
+    }
+
+    // Frame rate needed by this pattern and the sub pattern drawn over it
+    uint16_t framerate() {
+      uint16_t fps = motionFramerate();
+      return subPattern ? max(fps, subPattern->framerate()) : fps;
+    }
+
     virtual void stop() {
       if (isRunning()) {
         logf("Stopping %s", description());
-        stopTime = millis();
+        stopTime = gClock.millis();
       }
       if (subPattern) {
         subPattern->stop();
@@ -72,15 +219,16 @@ class Pattern {
     }
 
     bool isRunning() {
-      return startTime != -1;
+      return running;
     }
 
     bool isStopped() {
       return !isRunning();
     }
 
-    long runTime() {
-      return startTime == -1 ? 0 : millis() - startTime;
+    // unsigned, so it keeps counting past 2^31 ms (24.8 days) instead of going negative
+    uint32_t runTime() {
+      return running ? gClock.millis() - startTime : 0;
     }
 
     virtual void update(CRGBArray<NUM_LEDS> &leds) = 0;
@@ -100,19 +248,27 @@ class Pattern {
 
 
 class PinkFlash : public Pattern {
+  static const uint8_t kFadeBy = 3;
+  static constexpr uint16_t kFadeSteps = fadeStepsToBlack(kFadeBy);
   unsigned int fadeupStart[3] = {0};
+  FrameSteps steps;
   void setup() {
     for (int side = 0; side < 3; ++side) {
       fadeupStart[side] = 0;
     }
+    steps.reset(gClock.millis());
   }
   
   void update(CRGBArray<NUM_LEDS> &leds) {
+    // the flash odds and the fade are per frame at MAX_FRAMERATE
+    uint16_t frames = steps.elapsed(gClock.millis(), kFadeSteps);
     for (int side = 0; side < 3; ++side) {
-      if (random8() == 0) {
-        fadeupStart[side] = millis();
+      for (uint16_t i = 0; i < frames; ++i) {
+        if (random8() == 0) {
+          fadeupStart[side] = gClock.millis();
+        }
       }
-      unsigned int fadeupDuration = millis() - fadeupStart[side];
+      unsigned int fadeupDuration = gClock.millis() - fadeupStart[side];
       if (fadeupDuration < 100) {
         CRGB color = CRGB::DeepPink;
         color.nscale8(fadeupDuration * 0xFF/100);
@@ -122,7 +278,9 @@ class PinkFlash : public Pattern {
       }
     }
     
-    leds.fadeToBlackBy(3);
+    for (uint16_t i = 0; i < frames; ++i) {
+      leds.fadeToBlackBy(kFadeBy);
+    }
     for(CRGB & pixel : leds) {
       if (pixel.blue == 0) {
         pixel = CRGB::Black;
@@ -136,27 +294,15 @@ class PinkFlash : public Pattern {
 };
 
 class Bits : public Pattern {
+  public:
+    // largest maxBits in presets
+    static const unsigned int kMaxBits = 10;
+    static const uint8_t kPresetCount = 5;
+
+  private:
     enum BitColor {
       monotone, fromPalette, mix, white, pink
     };
-    typedef struct _BitsPreset {
-      unsigned int maxBits, bitLifespan, updateInterval, fadedown;
-      BitColor color;
-    } BitsPreset;
-
-    BitsPreset presets[5] = {
-//      { .maxBits = 4, .bitLifespan = 3000, .updateInterval = 35, .fadedown = 5, .color = white}, // dots enhancer
-//      { .maxBits = 4, .bitLifespan = 3000, .updateInterval = 45, .fadedown = 5, .color = fromPalette}, // dots enhancer
-      // little too frenetic, use as trigger patterns?
-      //      { .maxBits = 10, .bitLifespan = 3000, .updateInterval = 0, .fadedown = 20, .color = monotone }, // party streamers
-      //      { .maxBits = 10, .bitLifespan = 3000, .updateInterval = 0, .fadedown = 20, .color = mix }, // multi-color party streamers
-      { .maxBits = 5, .bitLifespan = 3000, .updateInterval = 8, .fadedown = 12, .color = pink}, // pink triangle
-      { .maxBits = 5, .bitLifespan = 3000, .updateInterval = 16, .fadedown = 5, .color = monotone }, // chill streamers
-      { .maxBits = 5, .bitLifespan = 3000, .updateInterval = 16, .fadedown = 5, .color = fromPalette}, // palette chill streamers
-      { .maxBits = 10, .bitLifespan = 3000, .updateInterval = 16, .fadedown = 30, .color = monotone }, // moving dots
-//      { .maxBits = 14, .bitLifespan = 3000, .updateInterval = 350, .fadedown = 5, .color = monotone }, // OG bits pattern
-      { .maxBits = 3, .bitLifespan = 3000, .updateInterval = 8, .fadedown = 50, .color = monotone }, // chase
-    };
 
     class Bit {
         int8_t direction;
@@ -170,135 +316,259 @@ class Bits : public Pattern {
           reset(color);
         }
         void reset(CRGB color) {
-          birthdate = millis();
+          birthdate = gClock.millis();
           alive = true;
           pos = random16() % NUM_LEDS;
           direction = random8(2) == 0 ? 1 : -1;
           this->color = color;
         }
         unsigned int age() {
-          return millis() - birthdate;
+          return gClock.millis() - birthdate;
         }
+        // fades in over the first 500ms and out over the last 500ms of the lifespan
+        template<unsigned int Lifespan>
         fract8 ageBrightness() {
-          // FIXME: assumes 3000ms lifespan
           float theAge = age();
           if (theAge < 500) {
             return theAge * 0xFF / 500;
-          } else if (theAge > 2500) {
-            return (3000 - theAge) * 0xFF / 500;
+          } else if (theAge > Lifespan - 500) {
+            return (Lifespan - theAge) * 0xFF / 500;
           }
           return 0xFF;
         }
         void tick() {
           pos = mod_wrap(pos + direction, NUM_LEDS);
-          lastTick = millis();
+          lastTick = gClock.millis();
         }
     };
 
-    Bit *bits;
-    unsigned int numBits;
-    unsigned int lastBitCreation;
-    BitsPreset preset;
+    // Each preset is its own instantiation, so the divisions, the bit pool bound and the color choice
+    // fold into constants instead of being read from a struct and switched on every frame.
+    template<unsigned int MaxBits, unsigned int Lifespan, unsigned int UpdateInterval, uint8_t Fadedown, BitColor Color>
+    struct Preset {
+      static_assert(MaxBits <= kMaxBits, "Bits preset wants more bits than kMaxBits has scratch for");
+
+      static CRGB bitColor(Bits &self) {
+        if (Color == monotone) {
+          return self.color;
+        } else if (Color == fromPalette) {
+          // falls back to monotone if there was no scratch for the palette
+          return self.palette ? ColorFromPalette(*self.palette, random8()) : self.color;
+        } else if (Color == mix) {
+          return fastHSV(random8(), random8(200, 255), 255);
+        } else if (Color == white) {
+          return CRGB::White;
+        }
+        return CRGB::DeepPink;
+      }
+
+      static void update(Bits &self, CRGBArray<NUM_LEDS> &leds) {
+        unsigned long mils = gClock.millis();
+        // each quality level halves the bits in flight
+        const unsigned int limit = max(1u, MaxBits >> self.quality);
+        for (unsigned int i = 0; i < limit && i < self.numBits; ++i) {
+          Bit *bit = &self.bits[i];
+          if (bit->age() > Lifespan) {
+            bit->alive = false;
+          }
+          if (bit->alive) {
+            leds[bit->pos] = blend(CRGB::Black, bit->color, bit->template ageBrightness<Lifespan>());
+            if (mils - bit->lastTick > UpdateInterval) {
+              bit->tick();
+            }
+          } else {
+            bit->reset(bitColor(self));
+          }
+        }
+
+        if (self.isRunning() && self.numBits < limit && mils - self.lastBitCreation > Lifespan / MaxBits) {
+          self.bits[self.numBits++] = Bit(bitColor(self));
+          self.lastBitCreation = mils;
+        }
+        // Fadedown is per frame at MAX_FRAMERATE
+        constexpr uint16_t kFadeSteps = fadeStepsToBlack(Fadedown);
+        for (uint16_t frames = self.steps.elapsed(mils, kFadeSteps); frames > 0; --frames) {
+          leds.fadeToBlackBy(Fadedown);
+        }
+      }
+    };
+
+    struct PresetEntry {
+      const char *name;
+      unsigned int maxBits;
+      bool usesPalette;
+      void (*update)(Bits &self, CRGBArray<NUM_LEDS> &leds);
+    };
+
+    template<unsigned int MaxBits, unsigned int Lifespan, unsigned int UpdateInterval, uint8_t Fadedown, BitColor Color>
+    static constexpr PresetEntry entry(const char *name) {
+      return {name, MaxBits, Color == fromPalette, &Preset<MaxBits, Lifespan, UpdateInterval, Fadedown, Color>::update};
+    }
+
+    //  maxBits, bitLifespan, updateInterval, fadedown, color
+    static const PresetEntry *presets() {
+      static const PresetEntry table[kPresetCount] = {
+//        entry<4, 3000, 35, 5, white>("dots enhancer"),
+//        entry<4, 3000, 45, 5, fromPalette>("dots enhancer"),
+        // little too frenetic, use as trigger patterns?
+//        entry<10, 3000, 0, 20, monotone>("party streamers"),
+//        entry<10, 3000, 0, 20, mix>("multi-color party streamers"),
+        entry<5, 3000, 8, 12, pink>("pink triangle"),
+        entry<5, 3000, 16, 5, monotone>("chill streamers"),
+        entry<5, 3000, 16, 5, fromPalette>("palette chill streamers"),
+        entry<10, 3000, 16, 30, monotone>("moving dots"),
+//        entry<14, 3000, 350, 5, monotone>("OG bits pattern"),
+        entry<3, 3000, 8, 50, monotone>("chase"),
+      };
+      return table;
+    }
+
+    Bit *bits = NULL;
+    unsigned int numBits = 0;
+    unsigned int lastBitCreation = 0;
+    const PresetEntry *preset;
     uint8_t constPreset;
 
     CRGB color;
-    CRGBPalette16 palette;
+    CRGBPalette16 *palette = NULL;
+    FrameSteps steps;
+    static const uint8_t kBuiltinPalettes = 4;
   public:
+    static const size_t kScratchBytes = scratchSize(kMaxBits * sizeof(Bit)) + scratchSize(sizeof(CRGBPalette16));
+
+    size_t scratchBytes() {
+      return kScratchBytes;
+    }
+
     Bits(int constPreset = -1) {
       this->constPreset = constPreset;
     }
-  private:
 
-    CRGB getBitColor() {
-      switch (preset.color) {
-        case monotone:
-          return color; break;
-        case fromPalette:
-          return ColorFromPalette(palette, random8()); break;
-        case mix:
-          return CHSV(random8(), random8(200, 255), 255); break;
-        case white:
-          return CRGB::White;
-        case pink:
-        default:
-          return CRGB::DeepPink;
+    // each preset in turn, with every palette choice (the builtin FastLED palettes, then the gradients) for
+    // the presets that draw from a palette, and one variant for those that don't
+    uint16_t variantCount() {
+      uint16_t count = 0;
+      for (uint8_t i = 0; i < kPresetCount; ++i) {
+        count += presetVariants(i);
       }
+      return count;
     }
 
-    void setup() {
+    static uint16_t presetVariants(uint8_t index) {
+      return presets()[index].usesPalette ? kBuiltinPalettes + gGradientPaletteCount : 1;
+    }
+
+    static const char *presetName(uint8_t index) {
+      return presets()[index].name;
+    }
+
+    uint8_t qualityLevels() {
+      return 3;
+    }
+
+  private:
+    void preload() {
       uint8_t pick;
-      if (constPreset != -1 && (uint16_t)constPreset < ARRAY_SIZE(presets)) {
+      // the palette choice within the picked preset's variants
+      int paletteVariant = -1;
+      if (variant != -1 && variant < variantCount()) {
+        paletteVariant = variant;
+        for (pick = 0; paletteVariant >= presetVariants(pick); ++pick) {
+          paletteVariant -= presetVariants(pick);
+        }
+        logf("Using variant Bits preset %u", pick);
+      } else if (constPreset != -1 && (uint16_t)constPreset < kPresetCount) {
         pick = constPreset;
         logf("Using const Bits preset %u", pick);
       } else {
-        pick = random8(ARRAY_SIZE(presets));
+        pick = random8(kPresetCount);
         logf("Picked Bits preset %u", pick);
       }
-      preset = presets[pick];
-
+      preset = &presets()[pick];
 
-      unsigned int paletteChoice = random8(5);
-      switch (paletteChoice) {
-        case 0: palette = OceanColors_p; break;
-        case 1: palette = LavaColors_p; break;
-        case 2: palette = ForestColors_p; break;
-        case 3: palette = PartyColors_p; break;
-        case 4: palette = gGradientPalettes[random16(ARRAY_SIZE(gGradientPalettes))];
+      bits = borrowScratch<Bit>(preset->maxBits);
+      numBits = 0;
+      // as a fresh instance, so a restart doesn't wait out the last run's bit timer
+      lastBitCreation = 0;
+
+      if (preset->usesPalette) {
+        palette = borrowScratch<CRGBPalette16>();
+        if (palette) {
+          unsigned int paletteChoice = (paletteVariant != -1 ? paletteVariant : random8(kBuiltinPalettes + 1));
+          switch (paletteChoice) {
+            case 0: *palette = OceanColors_p; break;
+            case 1: *palette = LavaColors_p; break;
+            case 2: *palette = ForestColors_p; break;
+            case 3: *palette = PartyColors_p; break;
+            default:
+              loadGradientPalette(*palette, paletteVariant != -1 ? paletteChoice - kBuiltinPalettes : random16(gGradientPaletteCount));
+          }
+        }
       }
       // for monotone
       color = CHSV(random8(), random8(8) == 0 ? 0 : random8(200, 255), 255);
+    }
 
-      bits = (Bit *)calloc(preset.maxBits, sizeof(Bit));
-      numBits = 0;
+    void setup() {
+      steps.reset(gClock.millis());
     }
 
     void update(CRGBArray<NUM_LEDS> &leds) {
-      unsigned long mils = millis();
-      bool hasAliveBit = false;
-      for (unsigned int i = 0; i < numBits; ++i) {
-        Bit *bit = &bits[i];
-        if (bit->age() > preset.bitLifespan) {
-          bit->alive = false;
-        }
-        if (bit->alive) {
-          leds[bit->pos] = blend(CRGB::Black, bit->color, bit->ageBrightness());
-          if (mils - bit->lastTick > preset.updateInterval) {
-            bit->tick();
-          }
-          hasAliveBit = true;
-        } else {
-          bit->reset(getBitColor());
-          hasAliveBit = true;
-        }
-      }
-
-      if (isRunning() && numBits < preset.maxBits && mils - lastBitCreation > preset.bitLifespan / preset.maxBits) {
-        bits[numBits++] = Bit(getBitColor());
-        lastBitCreation = mils;
+      if (!bits) {
+        return;
       }
-      leds.fadeToBlackBy(preset.fadedown);
+      preset->update(*this, leds);
     }
 
-    void stopCompleted() {
-      Pattern::stopCompleted();
-      if (bits) {
-        free(bits);
-        bits = NULL;
-        numBits = 0;
-      }
+    void scratchReturned() {
+      bits = NULL;
+      palette = NULL;
+      numBits = 0;
     }
 
     const char *description() {
       return "Bits pattern";
     }
+
+    friend void benchmarkBitsPresets(CRGBArray<NUM_LEDS> &leds);
 };
 
+// Per-preset update cost, for size_report.py to set against each instantiation's code size
+void benchmarkBitsPresets(CRGBArray<NUM_LEDS> &leds) {
+  const unsigned int kFrames = 2000;
+  const uint16_t kFrameMillis = 5;
+  for (uint8_t i = 0; i < Bits::kPresetCount; ++i) {
+    Bits bits(i);
+    gClock.useVirtualTime(1000);
+    random16_set_seed(1337);
+    leds.fill_solid(CRGB::Black);
+    bits.start();
+    unsigned long total = 0;
+    for (unsigned int frame = 0; frame < kFrames; ++frame) {
+      unsigned long start = micros();
+      bits.update(leds);
+      total += micros() - start;
+      gClock.advance(kFrameMillis);
+    }
+    bits.stop();
+    logf("bits preset %u %.2f us/frame %s", i, total / (float)kFrames, Bits::presetName(i));
+  }
+  gClock.useRealTime();
+  leds.fill_solid(CRGB::Black);
+}
+
 class StandingWaves : public Pattern {
     const unsigned waveSize = 6;
     float initialPhase;
     int initialHue1;
     int initialHue2;
     int direction;
+    // one trip round the 256 hues every 32 s
+    static const int32_t kHueDriftBpm88 = 480;
+    int8_t fadeOsc = -1;
+    int8_t hue1Osc = -1;
+    int8_t hue2Osc = -1;
+    uint8_t interlace = 0;
 
     Pattern *makeSubPattern() {
       if (true || random8(2) == 0) {
@@ -307,20 +577,27 @@ class StandingWaves : public Pattern {
       return NULL;
     }
 
-    void setup() {
+    void preload() {
       initialPhase = random8(waveSize);
       initialHue1 = random8(0xFF);
       initialHue2 = random8(0xFF);
       direction = random8(2) == 0 ? 1 : -1;
     }
 
+    void setup() {
+      fadeOsc = addOscillator(oscSine8, 24 << 8, 0, 255);
+      // hues drift 8 a second from where they started, as saws over the whole hue circle
+      hue1Osc = addOscillator(oscSaw, direction * kHueDriftBpm88, 0, 256, initialHue1 << 8, startTime);
+      hue2Osc = addOscillator(oscSaw, direction * kHueDriftBpm88, 0, 256, (initialHue2 + 120) << 8, startTime);
+    }
+
     void update(CRGBArray<NUM_LEDS> &leds) {
       float phase = 0;//initialPhase - direction * runTime() / 1000. * 2;
 
-      uint8_t fadeSpeed = beatsin8(24, 0, 255, phase);
+      uint8_t fadeSpeed = oscillator(fadeOsc);
 
-      int hue1 = mod_wrap(initialHue1 + direction * runTime() / 1000. * 8, 0xFF);
-      int hue2 = mod_wrap(initialHue2 + direction * runTime() / 1000. * 8 + 120, 0xFF);
+      uint8_t hue1 = oscillator(hue1Osc);
+      uint8_t hue2 = oscillator(hue2Osc);
 
       // FIXME: is this a better technique? fps 6xx instead of ~130, but looks different & phase needs fixing
       //      CRGB topColor = blend(CHSV(hue1, 255, 255), CRGB::Black, fadeSpeed);
@@ -333,23 +610,37 @@ class StandingWaves : public Pattern {
       //                                mod_wrap((segment + 1) * waveSize - 1 + phase, NUM_LEDS), bottomColor);
       //      }
 
+      // blend() of two CHSVs mixes hue and value independently, and hue doesn't vary per pixel
+      CHSV hueMix = blend(CHSV(hue1, 255, 0), CHSV(hue2, 255, 0), fadeSpeed);
+      uint8_t keep = 255 - fadeSpeed;
+
       float startBlend = min(runTime() / 1000. * 255, 255);
       float sin8Ratio = 0xFF / waveSize;
-      for (int i = 0; i < NUM_LEDS; ++i) {
+      // below full quality each frame redraws every second (or third) pixel, taking turns
+      uint8_t step = quality + 1;
+      interlace = (interlace + 1) % step;
+      for (int i = interlace; i < NUM_LEDS; i += step) {
         float offset = fmod_wrap(i + phase, 255) * sin8Ratio;
         int brightness1 = sin8(offset);
         brightness1 = brightness1 < 40 ? 0 : brightness1;
         int brightness2 = sin8(offset + 0x7F);
         brightness2 = brightness2 < 40 ? 0 : brightness2;
 
-        CHSV c1 = CHSV(hue1, 255, brightness1);
-        CHSV c2 = CHSV(hue2, 255, brightness2);
-
-        CRGB mix = blend(c1, c2, fadeSpeed);
+        uint8_t mixBrightness = scale8(brightness1, keep) + scale8(brightness2, fadeSpeed);
+        CRGB mix = fastHSV(hueMix.hue, hueMix.sat, mixBrightness);
         // TODO: fix single-subpixel aliasing?
         leds[i] = blend(leds[i], mix, startBlend);
       }
     }
+    // everything moves with runTime(); the Bits sub pattern sets the real rate
+    uint16_t motionFramerate() {
+      return 60;
+    }
+
+    uint8_t qualityLevels() {
+      return 3;
+    }
+
     const char *description() {
       return "StandingWaves";
     }
@@ -359,43 +650,68 @@ class Droplets : public Pattern {
   private:
     unsigned long lastDrop;
     unsigned long lastFlow;
-    CRGB cs[NUM_LEDS];
-    CRGBPalette16 palette;
+    CRGB *cs = NULL;
+    CRGBPalette16 *palette = NULL;
     bool usePalette;
 
     const unsigned int dropInterval = 450;
     unsigned int nextDropInterval = 0; // vary the drops
 
-    void setup() {
-      usePalette = (random(3) > 0);
+  public:
+    static const size_t kScratchBytes = scratchSize(NUM_LEDS * sizeof(CRGB)) + scratchSize(sizeof(CRGBPalette16));
+
+    size_t scratchBytes() {
+      return kScratchBytes;
+    }
+
+    // hue drops, then each gradient palette
+    uint16_t variantCount() {
+      return 1 + gGradientPaletteCount;
+    }
+
+  private:
+    void preload() {
+      cs = borrowScratch<CRGB>(NUM_LEDS);
+      usePalette = (variant == -1 ? random(3) > 0 : variant > 0);
       if (usePalette) {
-        palette = gGradientPalettes[random16(gGradientPaletteCount)];
+        palette = borrowScratch<CRGBPalette16>();
+        if (palette) {
+          loadGradientPalette(*palette, variant == -1 ? random16(gGradientPaletteCount) : variant - 1);
+        } else {
+          usePalette = false;
+        }
       }
       nextDropInterval = dropInterval;
     }
+
+    void scratchReturned() {
+      cs = NULL;
+      palette = NULL;
+    }
     
     void update(CRGBArray<NUM_LEDS> &leds) {
-      const unsigned int flowInterval = 30;
-      const float kFlow = 0.2;
-      const float kEff = 0.97;
+      // below full quality the flow runs half (or a quarter) as often, in bigger steps
+      const unsigned int flowInterval = 30 << quality;
+      const float kFlow = min(0.5, 0.2 * (1 << quality));
+      const float kEff = quality ? powf(0.97, 1 << quality) : 0.97;
       const int minLoss = 1;
 
-      unsigned long mils = millis();
+      unsigned long mils = gClock.millis();
       if (mils - lastDrop > nextDropInterval) {
         nextDropInterval = dropInterval + (dropInterval * 0.5) * (random8(2) ? -1 : 1);
         int center = random16(NUM_LEDS);
         CRGB color;
         if (usePalette) {
-          color = ColorFromPalette(palette, random8());
+          color = ColorFromPalette(*palette, random8());
         } else {
-          color = CHSV(random8(), 255, 255);
+          color = fastHSV(random8(), 255, 255);
         }
         for (int i = -2; i < 3; ++i) {
           leds[mod_wrap(center + i, NUM_LEDS)] = color;
         }
         lastDrop = mils;
       }
-      if (mils - lastFlow > flowInterval) {
+      if (cs && mils - lastFlow > flowInterval) {
         for (int i = 0; i < NUM_LEDS; ++i) {
           cs[i] = leds[i];
         }
@@ -435,6 +751,15 @@ class Droplets : public Pattern {
       }
     }
 
+    // frames 8 ms apart still run a flow every 32 ms, as they do at full rate
+    uint16_t motionFramerate() {
+      return 125;
+    }
+
+    uint8_t qualityLevels() {
+      return 3;
+    }
+
     const char *description() {
       return "Droplets";
     }
@@ -442,53 +767,149 @@ class Droplets : public Pattern {
 
 
 #define SECONDS_PER_PALETTE 20
-uint8_t gCurrentPaletteNumber = 0;
-CRGBPalette16 gCurrentPalette( CRGB::Black);
-CRGBPalette16 gTargetPalette( gGradientPalettes[0] );
 
 class SmoothPalettes : public Pattern {
+    // All state is per instance (no globals, statics or EVERY_N_* macros) so several can run side by side
+    uint8_t currentPaletteNumber = 0;
+    CRGBPalette16 *currentPalette = NULL;
+    CRGBPalette16 *targetPalette = NULL;
+    static const uint32_t kDrawMillis = 20;
+    CEveryNMillis drawTimer = CEveryNMillis(kDrawMillis);
+#if INDEXED_FRAMEBUFFER
+    IndexedFrame *frame = NULL;
+    CEveryNMillis resolveTimer = CEveryNMillis(kDrawMillis);
+#endif
+    CEveryNMillis paletteChangeTimer = CEveryNMillis(SECONDS_PER_PALETTE * 1000);
+    CEveryNMillis paletteBlendTimer = CEveryNMillis(40);
+
+    uint16_t pseudotime = 0;
+    uint16_t lastMillis = 0;
+    uint16_t baseHue16 = 0;
+
+    int8_t brightDepthOsc = -1;
+    int8_t brightnessThetaIncOsc = -1;
+    int8_t msMultiplierOsc = -1;
+    int8_t hueIncOsc = -1;
+    int8_t baseHueRateOsc = -1;
+
+  public:
+    static const size_t kScratchBytes = 2 * scratchSize(sizeof(CRGBPalette16)) +
+                                        (INDEXED_FRAMEBUFFER ? scratchSize(sizeof(IndexedFrame)) : 0);
+
+    size_t scratchBytes() {
+      return kScratchBytes;
+    }
+
+    uint16_t variantCount() {
+      return gGradientPaletteCount;
+    }
+
+  private:
+    void preload() {
+      currentPalette = borrowScratch<CRGBPalette16>();
+      targetPalette = borrowScratch<CRGBPalette16>();
+#if INDEXED_FRAMEBUFFER
+      frame = borrowScratch<IndexedFrame>();
+      if (!frame) {
+        currentPalette = NULL;
+      }
+#endif
+      if (!currentPalette || !targetPalette) {
+        return;
+      }
+      currentPaletteNumber = (variant == -1 ? random16(gGradientPaletteCount) : variant);
+      loadGradientPalette(*targetPalette, currentPaletteNumber);
+      brightDepthOsc = addOscillator(oscSine, 341, 96, 224);
+      brightnessThetaIncOsc = addOscillator(oscSine, 203, 25 * 256, 40 * 256);
+      msMultiplierOsc = addOscillator(oscSine, 147, 23, 60);
+      hueIncOsc = addOscillator(oscSine, 113, 300, 1500);
+      baseHueRateOsc = addOscillator(oscSine, 400, 5, 9);
+    }
+
     void setup() {
-      gTargetPalette = gGradientPalettes[random16(gGradientPaletteCount)];
+      // the same start as a fresh instance, and as the VM port's zeroed registers
+      pseudotime = 0;
+      lastMillis = 0;
+      baseHue16 = 0;
+      drawTimer.reset();
+#if INDEXED_FRAMEBUFFER
+      resolveTimer.reset();
+#endif
+      paletteChangeTimer.reset();
+      paletteBlendTimer.reset();
+    }
+
+    void scratchReturned() {
+      currentPalette = NULL;
+      targetPalette = NULL;
+#if INDEXED_FRAMEBUFFER
+      frame = NULL;
+#endif
     }
+
     void update(CRGBArray<NUM_LEDS> &leds) {
-      EVERY_N_MILLISECONDS(20) {
+      // half-rate draws below full quality
+      drawTimer.setPeriod(kDrawMillis << quality);
+      if (!currentPalette) {
+        return;
+      }
+#if INDEXED_FRAMEBUFFER
+      // Only the wave maths slows down below full quality: the palette blend and the resolve into leds
+      // keep their pace. At full quality both run in the same frames, in the same order as the RGB path.
+      bool resolving = resolveTimer.ready();
+      if (resolving) {
+        advancePalettes();
+      }
+      if (drawTimer.ready()) {
+        draw(leds);
+      }
+      if (resolving) {
+        frame->resolve(leds, *currentPalette, blendAmount());
+      }
+#else
+      if (drawTimer.ready()) {
+        advancePalettes();
         draw(leds);
       }
+#endif
     }
 
-    void draw(CRGBArray<NUM_LEDS> &leds) {
-      // ColorWavesWithPalettes
-      // Animated shifting color waves, with several cross-fading color palettes.
-      // by Mark Kriegsman, August 2015
-      CRGBPalette16& palette = gCurrentPalette;
-      EVERY_N_SECONDS( SECONDS_PER_PALETTE ) {
-        gCurrentPaletteNumber = addmod8( gCurrentPaletteNumber, random8(16), gGradientPaletteCount);
-        gTargetPalette = gGradientPalettes[ gCurrentPaletteNumber ];
+    void advancePalettes() {
+      if (paletteChangeTimer.ready()) {
+        currentPaletteNumber = addmod8( currentPaletteNumber, random8(16), gGradientPaletteCount);
+        loadGradientPalette(*targetPalette, currentPaletteNumber);
       }
 
-      EVERY_N_MILLISECONDS(40) {
-        nblendPaletteTowardPalette( gCurrentPalette, gTargetPalette, 16);
+      if (paletteBlendTimer.ready()) {
+        nblendPaletteTowardPalette( *currentPalette, *targetPalette, 16);
       }
+    }
 
+    // fades in over the first 2 s, then keeps half of the previous draw
+    uint8_t blendAmount() {
+      return runTime() < 2000 ? runTime() / 15 : 128;
+    }
+
+    void draw(CRGBArray<NUM_LEDS> &leds) {
+      // ColorWavesWithPalettes
+      // Animated shifting color waves, with several cross-fading color palettes.
+      // by Mark Kriegsman, August 2015
       uint16_t numleds = NUM_LEDS;
-      static uint16_t sPseudotime = 0;
-      static uint16_t sLastMillis = 0;
-      static uint16_t sHue16 = 0;
 
       //      uint8_t sat8 = beatsin88( 87, 220, 250);
-      uint8_t brightdepth = beatsin88( 341, 96, 224);
-      uint16_t brightnessthetainc16 = beatsin88( 203, (25 * 256), (40 * 256));
-      uint8_t msmultiplier = beatsin88(147, 23, 60);
+      uint8_t brightdepth = oscillator(brightDepthOsc);
+      uint16_t brightnessthetainc16 = oscillator(brightnessThetaIncOsc);
+      uint8_t msmultiplier = oscillator(msMultiplierOsc);
 
-      uint16_t hue16 = sHue16;//gHue * 256;
-      uint16_t hueinc16 = beatsin88(113, 300, 1500);
+      uint16_t hue16 = baseHue16;//gHue * 256;
+      uint16_t hueinc16 = oscillator(hueIncOsc);
 
-      uint16_t ms = millis();
-      uint16_t deltams = ms - sLastMillis ;
-      sLastMillis  = ms;
-      sPseudotime += deltams * msmultiplier;
-      sHue16 += deltams * beatsin88( 400, 5, 9);
-      uint16_t brightnesstheta16 = sPseudotime;
+      uint16_t ms = gClock.millis();
+      uint16_t deltams = ms - lastMillis ;
+      lastMillis  = ms;
+      pseudotime += deltams * msmultiplier;
+      baseHue16 += deltams * oscillator(baseHueRateOsc);
+      uint16_t brightnesstheta16 = pseudotime;
 
       for ( uint16_t i = 0 ; i < numleds; i++) {
         hue16 += hueinc16;
@@ -511,15 +932,26 @@ class SmoothPalettes : public Pattern {
         //index = triwave8( index);
         index = scale8( index, 240);
 
-        CRGB newcolor = ColorFromPalette( palette, index, bri8);
-
         uint16_t pixelnumber = i;
         pixelnumber = (numleds - 1) - pixelnumber;
 
-        uint8_t blendAmt = runTime() < 2000 ? runTime() / 15 : 128;
-        nblend( leds[pixelnumber], newcolor, blendAmt);
+#if INDEXED_FRAMEBUFFER
+        frame->set(pixelnumber, index, bri8);
+#else
+        CRGB newcolor = ColorFromPalette( *currentPalette, index, bri8);
+        nblend( leds[pixelnumber], newcolor, blendAmount());
+#endif
       }
     }
+    // only draws every 20 ms, and advances by elapsed time
+    uint16_t motionFramerate() {
+      return 50;
+    }
+
+    uint8_t qualityLevels() {
+      return 2;
+    }
+
     const char *description() {
       return "Smooth palettes";
     }
@@ -527,8 +959,14 @@ class SmoothPalettes : public Pattern {
 
 
 class PowerTest : public Pattern {
+    int8_t brightOsc = -1;
+
+    void setup() {
+      brightOsc = addOscillator(oscSine, 10 << 8, 0, 400);
+    }
+
     void update(CRGBArray<NUM_LEDS> &leds) {
-      int bright = min(0xFF, beatsin16(10, 0, 400));
+      int bright = min(0xFF, oscillator(brightOsc));
       logf("set brightness %i", bright);
       /* MY EYES */
       LEDS.setBrightness(bright);
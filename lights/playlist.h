@@ -0,0 +1,113 @@
+#ifndef PLAYLIST_H
+#define PLAYLIST_H
+
+#include "util.h"
+#include "patterns.h"
+
+// Gets the next idle pattern ready before it is needed. Its prepare() work (preset and palette choice,
+// palette decode into scratch, making the sub pattern) runs in a frame that has at least as much slack
+// left as that pattern took to prepare last time, so when the switch comes, start() only has the
+// time-dependent part of setup left to do. The scratch arena has to hold the running pattern and the
+// prepared one together; if the next pattern's scratchBytes() won't fit beside what's in use, or a borrow
+// fails anyway, nothing is prepared and start() does it all after the running pattern has stopped, as before.
+// With SWITCH_PROFILE, each switch frame's busy time is logged against the running average.
+const uint16_t kPrepareGuessMicros = 1000;
+
+class Playlist {
+  private:
+    Pattern **patterns;
+    unsigned count;
+    // how long each pattern took to prepare last time
+    uint16_t *prepareMicros;
+    Pattern *prepared = NULL;
+    // don't keep trying to prepare next to a pattern that leaves no room for it
+    int blockedBy = -1;
+
+    float averageFrameMicros = 0;
+    Pattern *switchedTo = NULL;
+    bool switchWasPrepared = false;
+
+  public:
+    Playlist(Pattern **patterns, unsigned count) : patterns(patterns), count(count) {
+      prepareMicros = new uint16_t[count];
+      for (unsigned i = 0; i < count; ++i) {
+        prepareMicros[i] = kPrepareGuessMicros;
+      }
+    }
+
+    ~Playlist() {
+      delete[] prepareMicros;
+    }
+
+    unsigned nextIndex(int activeIndex) {
+      return (activeIndex + 1) % count;
+    }
+
+    // Call once a frame, after the LEDs are out, with the time left before the next frame is due
+    void useSlack(int activeIndex, int32_t slackMicros) {
+      unsigned index = nextIndex(activeIndex);
+      Pattern *next = patterns[index];
+      if (prepared && prepared != next) {
+        cancel();
+      }
+      if (next->isRunning() || next->isPrepared() || activeIndex == blockedBy || slackMicros < prepareMicros[index]) {
+        return;
+      }
+      if (gScratch.bytesInUse() + next->scratchBytes() > SCRATCH_ARENA_BYTES) {
+        logf("Not enough scratch to prepare %s ahead (%u bytes wanted, %u in use); it will set up when it starts",
+             next->description(), (unsigned)next->scratchBytes(), gScratch.bytesInUse());
+        blockedBy = activeIndex;
+        return;
+      }
+      unsigned long failures = gScratch.failedBorrows();
+      uint32_t start = micros();
+      next->setVariant(-1);
+      next->prepare();
+      uint32_t elapsed = micros() - start;
+      prepareMicros[index] = min(elapsed, 0xFFFF);
+      if (gScratch.failedBorrows() != failures) {
+        logf("Not enough scratch to prepare %s ahead; it will set up when it starts", next->description());
+        next->unprepare();
+        blockedBy = activeIndex;
+        return;
+      }
+      prepared = next;
+#if SWITCH_PROFILE
+      logf("Prepared %s ahead in %lu us, with %li us of slack", next->description(), (unsigned long)elapsed, (long)slackMicros);
+#endif
+    }
+
+    // Throws away the prepared pattern unless it has started since, e.g. when a pattern is picked directly
+    void cancel() {
+      if (prepared) {
+        prepared->unprepare();
+        prepared = NULL;
+      }
+      blockedBy = -1;
+    }
+
+    // Call just before a switch starts next
+    void switching(Pattern *next) {
+      switchedTo = next;
+      switchWasPrepared = next->isPrepared();
+      if (next == prepared) {
+        prepared = NULL;
+      }
+      blockedBy = -1;
+    }
+
+    // Call at the end of each frame's work, before any sleep
+    void frameCompleted(uint32_t busyMicros) {
+      if (switchedTo) {
+#if SWITCH_PROFILE
+        logf("Switch to %s (%s): frame busy %lu us, typical %.0f us", switchedTo->description(),
+             switchWasPrepared ? "prepared ahead" : "set up inline", (unsigned long)busyMicros, averageFrameMicros);
+#endif
+        switchedTo = NULL;
+        return;
+      }
+      averageFrameMicros = averageFrameMicros == 0 ? busyMicros : averageFrameMicros * 0.95 + busyMicros * 0.05;
+    }
+};
+
+#endif
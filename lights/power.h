@@ -0,0 +1,115 @@
+#ifndef POWER_H
+#define POWER_H
+
+#include "util.h"
+#include "patterns.h"
+
+// Power governor. Each frame's rate comes from what the active pattern needs (Pattern::framerate()),
+// lowered further when the brightness is faded down, and the core sleeps with WFI until the frame is due
+// instead of spinning in delay(). SysTick wakes it every millisecond, and serial input wakes it sooner.
+// Awake time and LED output feed a rough current model for a battery life estimate; emu.py battery runs
+// the same model over every idle pattern on the host.
+#ifndef BATTERY_MAH
+#define BATTERY_MAH 2000
+#endif
+
+// Rough current model: the MCU awake or in WFI, plus each APA102's quiescent draw and each channel at full PWM
+const float kMcuAwakeMilliamps = 40;
+const float kMcuSleepMilliamps = 16;
+const float kLedQuiescentMilliamps = 0.6;
+const float kLedChannelMilliamps = 12;
+
+// Below this brightness the frame rate drops in proportion, down to minFramerate
+const uint8_t kGovernorFullRateBrightness = 64;
+const uint16_t kGovernorMinFramerate = 20;
+const uint32_t kGovernorWindowMicros = 10000000;
+
+class PowerGovernor {
+  private:
+    uint32_t frameDeadline = 0;
+    uint32_t awakeSince = 0;
+    uint32_t windowStart = 0;
+    uint32_t windowAwakeMicros = 0;
+    uint32_t windowFrames = 0;
+    float windowLedMilliamps = 0;
+    bool started = false;
+
+  public:
+    uint16_t framerate = MAX_FRAMERATE;
+    // the rate never goes below this, whatever the pattern asks for; the HD output's dither raises it
+    uint16_t minFramerate = kGovernorMinFramerate;
+    // averages over the last complete window
+    float dutyCycle = 1;
+    float ledMilliamps = 0;
+
+    uint16_t chooseFramerate(Pattern *pattern, uint8_t brightness, bool touched) {
+      uint16_t fps = pattern ? pattern->framerate() : MAX_FRAMERATE;
+      // keep the full rate while a finger is down so the brightness fader follows it smoothly
+      if (!touched && brightness < kGovernorFullRateBrightness) {
+        fps = (uint32_t)fps * brightness / kGovernorFullRateBrightness;
+      }
+      return max(fps, minFramerate);
+    }
+
+    // Call once per loop() after show(). Sleeps until the next frame is due.
+    void frameCompleted(Pattern *pattern, const CRGB *leds, uint16_t count, uint8_t brightness, bool touched) {
+      uint32_t now = micros();
+      if (!started) {
+        started = true;
+        awakeSince = windowStart = frameDeadline = now;
+      }
+      windowAwakeMicros += now - awakeSince;
+      ++windowFrames;
+      windowLedMilliamps += ledCurrent(leds, count, brightness);
+
+      framerate = chooseFramerate(pattern, brightness, touched);
+      frameDeadline += 1000000 / framerate;
+      if ((int32_t)(now - frameDeadline) >= 0) {
+        // overran the frame, so start the schedule again from now rather than trying to catch up
+        frameDeadline = now;
+      }
+      while ((int32_t)(micros() - frameDeadline) < 0) {
+#if defined(__arm__)
+        asm volatile("wfi");
+#endif
+      }
+      awakeSince = micros();
+
+      if (awakeSince - windowStart >= kGovernorWindowMicros) {
+        dutyCycle = windowAwakeMicros / (float)(awakeSince - windowStart);
+        ledMilliamps = windowLedMilliamps / windowFrames;
+#if POWER_STATS
+        logf("Power: %u fps, awake %.1f%%, ~%.0f mA (LEDs %.0f mA), ~%.1f h on %u mAh",
+             framerate, 100 * dutyCycle, estimatedMilliamps(), ledMilliamps, batteryHours(), BATTERY_MAH);
+#endif
+        windowStart = awakeSince;
+        windowAwakeMicros = 0;
+        windowFrames = 0;
+        windowLedMilliamps = 0;
+      }
+    }
+
+    // Time left before the frame in progress is due, at the current rate
+    int32_t slackMicros() {
+      return (int32_t)(frameDeadline + 1000000 / framerate - micros());
+    }
+
+    float estimatedMilliamps() {
+      return kMcuAwakeMilliamps * dutyCycle + kMcuSleepMilliamps * (1 - dutyCycle) + ledMilliamps;
+    }
+
+    float batteryHours() {
+      return BATTERY_MAH / estimatedMilliamps();
+    }
+
+    // LED current for one frame, before the global brightness is applied to leds
+    float ledCurrent(const CRGB *leds, uint16_t count, uint8_t brightness) {
+      uint32_t sum = 0;
+      for (uint16_t i = 0; i < count; ++i) {
+        sum += leds[i].r + leds[i].g + leds[i].b;
+      }
+      return count * kLedQuiescentMilliamps + kLedChannelMilliamps * sum / 255 * brightness / 255;
+    }
+};
+
+#endif
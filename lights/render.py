@@ -0,0 +1,272 @@
+#!/usr/bin/env python3
+# Renders captured frames (CLIP_RECORD or GOLDEN_CAPTURE serial logs) as video of the triangle, with LEDs
+# placed where they sit on triangle.kicad_pcb. Frames are read, drawn and written one at a time, so memory
+# stays bounded however long the capture is.
+#
+#   ./render.py capture.log -o out.avi                    uncompressed AVI
+#   ./render.py capture.log -o out.gif --fps 25           animated GIF
+#   ./render.py before.log after.log -o diff.avi          side by side, e.g. before/after an optimization
+#
+# For golden logs with several patterns, pick one with --pattern (matched against the logged name).
+import argparse
+import itertools
+import math
+import os
+import re
+import struct
+import sys
+
+SCALE = 4          # pixels per mm
+GLOW_RADIUS = 1.8  # mm, a little under half the 4 mm LED pitch so glows don't overlap
+LEVELS = 8         # brightness steps across a glow
+MARGIN = 4         # mm
+
+def led_positions(pcb_path, count):
+	positions = {}
+	at = None
+	for line in open(pcb_path):
+		line = line.strip()
+		if line.startswith("(module "):
+			at = None
+		elif at is None and line.startswith("(at "):
+			at = [float(v) for v in line[4:].rstrip(")").split()[:2]]
+		else:
+			match = re.match(r"\(fp_text reference D(\d+) ", line)
+			if match and at is not None:
+				positions[int(match.group(1))] = at
+	missing = [i for i in range(count) if i not in positions]
+	assert not missing, "LEDs missing from {}: {}".format(pcb_path, missing)
+	return [positions[i] for i in range(count)]
+
+def read_frames(path, pattern):
+	"""Yields (frameMillis, frame bytes) for the chosen capture in a log, reading lazily."""
+	frame_millis = None
+	selected = False
+	for line in open(path, errors="replace"):
+		words = line.split()
+		if len(words) < 3 or words[0] not in ("clip", "golden"):
+			continue
+		if words[1] == "begin":
+			if selected and frame_millis is not None:
+				return
+			name = " ".join(words[5:]) if words[0] == "golden" else ""
+			selected = pattern is None or pattern.lower() in name.lower()
+			frame_millis = int(words[2])
+		elif words[1] == "frame" and selected and frame_millis is not None:
+			yield frame_millis, bytes.fromhex(words[2])
+
+class Tile:
+	"""Draws one capture into its slot of the output image, using bytes.translate for the per-pixel work."""
+	def __init__(self, positions, x_offset, width, height, bottom_up, bgr):
+		xs = [p[0] for p in positions]
+		ys = [p[1] for p in positions]
+		min_x, min_y = min(xs) - MARGIN, min(ys) - MARGIN
+		self.width = int(math.ceil((max(xs) + MARGIN - min_x) * SCALE))
+		self.height = int(math.ceil((max(ys) + MARGIN - min_y) * SCALE))
+		radius = GLOW_RADIUS * SCALE
+		self.sprites = []
+		for (x, y) in positions:
+			cx, cy = (x - min_x) * SCALE, (y - min_y) * SCALE
+			rows = []
+			for py in range(int(cy - radius), int(cy + radius) + 1):
+				left = int(cx - radius)
+				span = []
+				for px in range(left, int(cx + radius) + 1):
+					distance = math.hypot(px + 0.5 - cx, py + 0.5 - cy) / radius
+					span.append(None if distance >= 1 else min(LEVELS - 1, int(distance * LEVELS)))
+				covered = [i for i, level in enumerate(span) if level is not None]
+				if not covered:
+					continue
+				row_start = left + covered[0]
+				levels = span[covered[0]:covered[-1] + 1]
+				out_y = (height - 1 - py) if bottom_up else py
+				offset = (out_y * width + x_offset + row_start) * 3
+				rgb_order = (2, 1, 0) if bgr else (0, 1, 2)
+				template = bytes(3 * level + channel for level in levels for channel in rgb_order)
+				rows.append((offset, template))
+			self.sprites.append(rows)
+		self.falloff = [int(255 * (1 - (level / float(LEVELS)) ** 2)) for level in range(LEVELS)]
+
+	def draw(self, image, frame):
+		padding = bytes(256 - 3 * LEVELS)
+		for led, rows in enumerate(self.sprites):
+			r, g, b = frame[3 * led:3 * led + 3]
+			if not (r or g or b):
+				continue
+			table = bytes(c * w // 255 for w in self.falloff for c in (r, g, b)) + padding
+			for offset, template in rows:
+				image[offset:offset + len(template)] = template.translate(table)
+
+class AviWriter:
+	"""Uncompressed 24-bit AVI. Sizes and the index are patched in at close()."""
+	def __init__(self, path, width, height, fps):
+		self.out = open(path, "wb")
+		self.width, self.height = width, height
+		self.row_bytes = (width * 3 + 3) & ~3
+		self.frame_bytes = self.row_bytes * height
+		self.frames = 0
+		self.index = []
+		header = self.headers(fps)
+		self.out.write(header)
+		self.movi_start = self.out.tell() - 4
+
+	def headers(self, fps):
+		avih = struct.pack("<IIIIIIIIII4I", int(1000000 / fps), self.frame_bytes * fps, 0, 0x10, 0, 0, 1, self.frame_bytes, self.width, self.height, 0, 0, 0, 0)
+		strh = struct.pack("<4s4sIHHIIIIIIIIhhhh", b"vids", b"DIB ", 0, 0, 0, 0, 1, fps, 0, 0, self.frame_bytes, 0xFFFFFFFF, 0, 0, 0, self.width, self.height)
+		strf = struct.pack("<IiiHHIIiiII", 40, self.width, self.height, 1, 24, 0, self.frame_bytes, 0, 0, 0, 0)
+		strl = b"strl" + chunk(b"strh", strh) + chunk(b"strf", strf)
+		hdrl = b"hdrl" + chunk(b"avih", avih) + list_chunk(strl)
+		return b"RIFF" + struct.pack("<I", 0) + b"AVI " + list_chunk(hdrl) + b"LIST" + struct.pack("<I", 0) + b"movi"
+
+	def write(self, image):
+		if self.row_bytes != self.width * 3:
+			padding = bytes(self.row_bytes - self.width * 3)
+			image = b"".join(image[y * self.width * 3:(y + 1) * self.width * 3] + padding for y in range(self.height))
+		self.index.append(self.out.tell() - self.movi_start)
+		self.out.write(chunk(b"00db", bytes(image)))
+		self.frames += 1
+
+	def close(self):
+		movi_end = self.out.tell()
+		self.out.write(b"idx1" + struct.pack("<I", 16 * len(self.index)))
+		for offset in self.index:
+			self.out.write(struct.pack("<4sIII", b"00db", 0x10, offset, self.frame_bytes))
+		end = self.out.tell()
+		self.out.seek(4)
+		self.out.write(struct.pack("<I", end - 8))
+		# total frames in avih, stream length in strh
+		self.out.seek(48)
+		self.out.write(struct.pack("<I", self.frames))
+		self.out.seek(140)
+		self.out.write(struct.pack("<I", self.frames))
+		self.out.seek(self.movi_start - 4)
+		self.out.write(struct.pack("<I", movi_end - self.movi_start))
+		self.out.close()
+
+def chunk(fourcc, data):
+	return fourcc + struct.pack("<I", len(data)) + data + (b"\0" if len(data) % 2 else b"")
+
+def list_chunk(data):
+	return chunk(b"LIST", data)
+
+class GifWriter:
+	"""Animated GIF with a fixed 6x6x6 color cube palette, LZW-encoded a frame at a time."""
+	def __init__(self, path, width, height, fps):
+		self.out = open(path, "wb")
+		self.width, self.height = width, height
+		self.delay = max(2, int(round(100.0 / fps)))
+		palette = bytes(v * 51 for r in range(6) for g in range(6) for b in range(6) for v in (r, g, b)) + bytes(3 * 40)
+		self.out.write(b"GIF89a" + struct.pack("<HHBBB", width, height, 0xF7, 0, 0) + palette)
+		self.out.write(b"\x21\xFF\x0BNETSCAPE2.0\x03\x01\x00\x00\x00")
+		# 6x6x6 cube lookup for each byte triple, built once
+		self.quantize = bytes((v + 25) // 51 for v in range(256))
+
+	def write(self, image):
+		q = bytes(image).translate(self.quantize)
+		indices = bytes(36 * r + 6 * g + b for r, g, b in zip(q[0::3], q[1::3], q[2::3]))
+		self.out.write(struct.pack("<BBBBHB", 0x21, 0xF9, 4, 0x04, self.delay, 0) + b"\0")
+		self.out.write(b"\x2C" + struct.pack("<HHHHB", 0, 0, self.width, self.height, 0))
+		self.out.write(b"\x08")
+		data = lzw(indices, 8)
+		for i in range(0, len(data), 255):
+			block = data[i:i + 255]
+			self.out.write(bytes([len(block)]) + block)
+		self.out.write(b"\0")
+
+	def close(self):
+		self.out.write(b"\x3B")
+		self.out.close()
+
+def lzw(indices, min_code_size):
+	clear = 1 << min_code_size
+	end = clear + 1
+	out = bytearray()
+	bits = 0
+	bit_count = 0
+
+	def emit(code, size):
+		nonlocal bits, bit_count
+		bits |= code << bit_count
+		bit_count += size
+		while bit_count >= 8:
+			out.append(bits & 0xFF)
+			bits >>= 8
+			bit_count -= 8
+
+	code_size = min_code_size + 1
+	table = dict((bytes([i]), i) for i in range(clear))
+	next_code = end + 1
+	emit(clear, code_size)
+	current = b""
+	for i in range(len(indices)):
+		symbol = indices[i:i + 1]
+		extended = current + symbol
+		if extended in table:
+			current = extended
+			continue
+		emit(table[current], code_size)
+		if next_code < 4096:
+			table[extended] = next_code
+			next_code += 1
+			if next_code > (1 << code_size) and code_size < 12:
+				code_size += 1
+		else:
+			emit(clear, code_size)
+			table = dict((bytes([i]), i) for i in range(clear))
+			next_code = end + 1
+			code_size = min_code_size + 1
+		current = symbol
+	if current:
+		emit(table[current], code_size)
+	emit(end, code_size)
+	if bit_count:
+		out.append(bits & 0xFF)
+	return bytes(out)
+
+def resample(frames, fps):
+	"""Picks the capture frame showing at each output frame time."""
+	out_millis = 1000.0 / fps
+	t = 0.0
+	captured_until = 0.0
+	frame = None
+	for frame_millis, captured in frames:
+		captured_until += frame_millis
+		frame = captured
+		while t < captured_until:
+			yield frame
+			t += out_millis
+
+def main():
+	parser = argparse.ArgumentParser()
+	parser.add_argument("captures", nargs="+", help="Capture logs; more than one are tiled side by side")
+	parser.add_argument("-o", dest="output", required=True, help="Output .avi or .gif")
+	parser.add_argument("--fps", type=int, default=50)
+	parser.add_argument("--pattern", help="Pattern to render from golden logs")
+	parser.add_argument("--pcb", default=os.path.join(os.path.dirname(os.path.realpath(__file__)), "..", "triangle.kicad_pcb"))
+	args = parser.parse_args()
+
+	streams = [resample(read_frames(path, args.pattern), args.fps) for path in args.captures]
+	firsts = [next(stream, None) for stream in streams]
+	if any(first is None for first in firsts):
+		sys.exit("no frames found in {}".format(", ".join(p for p, f in zip(args.captures, firsts) if f is None)))
+	positions = led_positions(args.pcb, len(firsts[0]) // 3)
+
+	is_gif = args.output.lower().endswith(".gif")
+	probe = Tile(positions, 0, 0, 0, False, False)
+	width, height = probe.width * len(streams), probe.height
+	tiles = [Tile(positions, i * probe.width, width, height, not is_gif, not is_gif) for i in range(len(streams))]
+	writer = (GifWriter if is_gif else AviWriter)(args.output, width, height, args.fps)
+
+	blank = bytes(width * height * 3)
+	count = 0
+	for frames in itertools.chain([firsts], zip(*streams)):
+		image = bytearray(blank)
+		for tile, frame in zip(tiles, frames):
+			tile.draw(image, frame)
+		writer.write(image)
+		count += 1
+	writer.close()
+	print("{}: {} frames, {}x{} at {} fps ({:.1f} s)".format(args.output, count, width, height, args.fps, count / float(args.fps)))
+
+if __name__ == "__main__":
+	main()
@@ -0,0 +1,108 @@
+#ifndef SCRATCH_H
+#define SCRATCH_H
+
+#include "util.h"
+
+#ifndef SCRATCH_ARENA_BYTES
+#define SCRATCH_ARENA_BYTES 512
+#endif
+
+#define SCRATCH_MAX_BLOCKS 8
+
+// Scratch sizes are rounded up so every block stays word aligned
+constexpr size_t scratchSize(size_t bytes) {
+  return (bytes + 3) & ~(size_t)3;
+}
+
+// Working memory shared by whatever patterns are currently running.
+// Patterns borrow blocks as they start (or are prepared to) and the arena takes them all back when the pattern stops,
+// so RAM use follows the active set instead of the number of patterns compiled in.
+class ScratchArena {
+  private:
+    typedef struct _Block {
+      const void *owner;
+      uint16_t offset;
+      uint16_t size;
+    } Block;
+
+    uint8_t buffer[SCRATCH_ARENA_BYTES] __attribute__((aligned(4)));
+    Block blocks[SCRATCH_MAX_BLOCKS]; // sorted by offset
+    uint8_t blockCount = 0;
+    uint16_t inUse = 0;
+    uint16_t highWater = 0;
+    unsigned long failures = 0;
+
+  public:
+    // Returns zeroed memory (like calloc), or NULL if the arena is full
+    void *borrow(const void *owner, size_t size) {
+      size = scratchSize(size);
+      if (blockCount == SCRATCH_MAX_BLOCKS) {
+        logf("ERROR: scratch arena out of blocks");
+        ++failures;
+        return NULL;
+      }
+      // first fit between existing blocks
+      size_t offset = 0;
+      uint8_t slot = 0;
+      for (; slot < blockCount; ++slot) {
+        if (blocks[slot].offset - offset >= size) {
+          break;
+        }
+        offset = blocks[slot].offset + blocks[slot].size;
+      }
+      if (offset + size > SCRATCH_ARENA_BYTES) {
+        logf("ERROR: scratch arena exhausted (%u bytes wanted, %u of %u in use)", (unsigned)size, inUse, SCRATCH_ARENA_BYTES);
+        ++failures;
+        return NULL;
+      }
+      memmove(&blocks[slot + 1], &blocks[slot], (blockCount - slot) * sizeof(Block));
+      blocks[slot].owner = owner;
+      blocks[slot].offset = offset;
+      blocks[slot].size = size;
+      ++blockCount;
+      inUse += size;
+      if (offset + size > highWater) {
+        highWater = offset + size;
+      }
+      memset(&buffer[offset], 0, size);
+      return &buffer[offset];
+    }
+
+    template<typename T>
+    T *borrow(const void *owner, size_t count = 1) {
+      return (T *)borrow(owner, count * sizeof(T));
+    }
+
+    void giveBack(const void *owner) {
+      uint8_t kept = 0;
+      for (uint8_t i = 0; i < blockCount; ++i) {
+        if (blocks[i].owner == owner) {
+          inUse -= blocks[i].size;
+        } else {
+          blocks[kept++] = blocks[i];
+        }
+      }
+      blockCount = kept;
+    }
+
+    uint16_t bytesInUse() {
+      return inUse;
+    }
+
+    uint16_t highWaterMark() {
+      return highWater;
+    }
+
+    unsigned long failedBorrows() {
+      return failures;
+    }
+};
+
+ScratchArena gScratch;
+
+// Logs the compile-time footprint of a pattern class: resident object size plus peak scratch borrowed while running
+#define SCRATCH_REPORT(PatternClass) \
+  static_assert(PatternClass::kScratchBytes <= SCRATCH_ARENA_BYTES, #PatternClass " needs more scratch than the arena has"); \
+  logf("  %-16s %4u bytes resident, %4u bytes scratch", #PatternClass, (unsigned)sizeof(PatternClass), (unsigned)PatternClass::kScratchBytes)
+
+#endif
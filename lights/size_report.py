@@ -0,0 +1,72 @@
+#!/usr/bin/env python3
+# Code size against speed for each Bits preset, now that every preset is its own instantiation of Bits::Preset.
+#
+#   ./size_report.py /tmp/arduino_build_*/lights.ino.elf boot.log
+#
+# Sizes come from nm on the built ELF. Speeds come from the "bits preset" lines that BITS_BENCHMARK logs at boot;
+# leave the log out for sizes only. Instantiations are matched to presets by their template arguments, read from
+# the registry in patterns.h.
+import argparse
+import os
+import re
+import subprocess
+from collections import defaultdict
+
+HERE = os.path.dirname(os.path.realpath(__file__))
+
+def read_registry(path):
+	source = open(path).read()
+	colors = re.search(r"enum BitColor \{([^}]*)\}", source).group(1)
+	color_values = dict((name.strip(), i) for i, name in enumerate(colors.split(",")))
+	presets = []
+	for line in source.splitlines():
+		match = re.match(r'\s*entry<([^>]*)>\("([^"]*)"\)', line)
+		if match:
+			args = [a.strip() for a in match.group(1).split(",")]
+			presets.append((tuple(int(a) if a.isdigit() else color_values[a] for a in args), match.group(2)))
+	return presets
+
+def template_args(text):
+	# "5u, 3000u, 8u, (unsigned char)12, (Bits::BitColor)4" -> (5, 3000, 8, 12, 4)
+	return tuple(int(re.sub(r"^\([^)]*\)", "", a.strip()).rstrip("u")) for a in text.split(","))
+
+def read_sizes(elf, nm):
+	sizes = defaultdict(int)
+	output = subprocess.check_output([nm, "-C", "--print-size", elf], universal_newlines=True)
+	for line in output.splitlines():
+		parts = line.split(None, 3)
+		if len(parts) < 4 or parts[2].lower() not in ("t", "w"):
+			continue
+		match = re.match(r"Bits::Preset<([^>]*)>::", parts[3])
+		if match:
+			sizes[template_args(match.group(1))] += int(parts[1], 16)
+	return sizes
+
+def read_speeds(log):
+	speeds = {}
+	for line in open(log, errors="replace"):
+		match = re.match(r"bits preset (\d+) ([\d.]+) us/frame", line.strip())
+		if match:
+			speeds[int(match.group(1))] = float(match.group(2))
+	return speeds
+
+def main():
+	parser = argparse.ArgumentParser()
+	parser.add_argument("elf")
+	parser.add_argument("log", nargs="?", help="Serial log from a BITS_BENCHMARK boot")
+	parser.add_argument("--nm", default="arm-none-eabi-nm")
+	parser.add_argument("--patterns", default=os.path.join(HERE, "patterns.h"))
+	args = parser.parse_args()
+
+	presets = read_registry(args.patterns)
+	sizes = read_sizes(args.elf, args.nm)
+	speeds = read_speeds(args.log) if args.log else {}
+	print("{:>2}  {:<26} {:>10} {:>12}".format("#", "preset", "code bytes", "us/frame"))
+	for i, (template, name) in enumerate(presets):
+		size = sizes.get(template)
+		speed = speeds.get(i)
+		print("{:>2}  {:<26} {:>10} {:>12}".format(i, name, size if size is not None else "inlined?", "{:.2f}".format(speed) if speed is not None else "-"))
+	print("total preset code: {} bytes".format(sum(sizes.values())))
+
+if __name__ == "__main__":
+	main()
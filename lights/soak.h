@@ -0,0 +1,191 @@
+#ifndef SOAK_H
+#define SOAK_H
+
+#include <malloc.h>
+#include "util.h"
+#include "patterns.h"
+
+// Accelerated-time soak test. The full loop() runs on a virtual clock that moves a whole frame step
+// per iteration with no framerate clamp, starting just short of the millis() wraparound so the wrap is
+// crossed early. Touch input is simulated: taps advance the pattern and holds drive the brightness fader.
+// Once per simulated hour it reports heap and frame-time drift, and flags time glitches as they happen.
+//
+// Watching the running patterns only shows a wrap bug if a pattern happens to start on the wrong
+// millisecond, so each time the clock crosses a wrap point (millis() going past 2^31, where times stop
+// fitting a long, and past 2^32) a probe pattern is also started a step before it, on the millisecond
+// before it (for 2^32 that's 0xFFFFFFFF, which is -1 as a long) and on it, and its times are checked.
+// At the start the probe also runs for a step past 2^31 ms, longer than the soak itself can.
+//
+// emu.py soak builds this into a host program that runs as fast as the host can. On a pendant it only
+// reaches tens of times real speed, too slow for more than a few simulated days.
+
+// A do-nothing pattern that lets the soak test see the start and stop times Pattern keeps
+class WrapProbe : public Pattern {
+  public:
+    uint32_t stoppedAfter = 0;
+
+    uint32_t startedAt() {
+      return startTime;
+    }
+
+    void update(CRGBArray<NUM_LEDS> &leds) { }
+
+    const char *description() {
+      return "wrap probe";
+    }
+
+  protected:
+    void stopCompleted() {
+      stoppedAfter = stopTime - startTime;
+      Pattern::stopCompleted();
+    }
+};
+
+class SoakTest {
+  private:
+    uint32_t stepMillis;
+    uint32_t startMillis;
+    uint64_t elapsedMillis = 0;
+
+    // simulated touch: a tap every tapInterval, and every holdEvery'th touch is a long hold instead
+    const uint32_t tapInterval = 45 * 1000;
+    const uint32_t tapLength = 100;
+    const uint32_t holdLength = 3000;
+    const unsigned holdEvery = 5;
+    uint32_t touchStart = 0;
+    uint32_t touchLength = 0;
+    unsigned touches = 0;
+
+    Pattern *watchedPattern = NULL;
+    uint32_t lastRunTime = 0;
+    unsigned long glitches = 0;
+    unsigned long wraps = 0;
+
+    unsigned long frames = 0;
+    unsigned long hourFrames = 0;
+    unsigned long hourMicros = 0;
+    unsigned long frameStartMicros = 0;
+    float firstHourFrameMicros = 0;
+    int heapHighWater = 0;
+    uint64_t nextReport = 3600000;
+    WrapProbe probe;
+
+  public:
+    void begin(uint32_t stepMillis, uint32_t millisBeforeWrap) {
+      this->stepMillis = stepMillis;
+      startMillis = (uint32_t)0 - millisBeforeWrap;
+      gClock.useVirtualTime(startMillis);
+      touchStart = startMillis + tapInterval;
+      logf("Soak test: %u ms per frame, starting %u ms before millis() wraps", stepMillis, millisBeforeWrap);
+      probeRun(startMillis, 0x80000000 + stepMillis);
+      frameStartMicros = micros();
+    }
+
+    // stands in for touchRead(TOUCH_PIN)
+    int touchValue() {
+      uint32_t now = gClock.millis();
+      if (touchLength == 0 && (int32_t)(now - touchStart) >= 0) {
+        touchLength = (++touches % holdEvery == 0 ? holdLength : tapLength);
+      }
+      if (touchLength != 0) {
+        if (now - touchStart < touchLength) {
+          return 1000;
+        }
+        touchLength = 0;
+        touchStart += tapInterval;
+      }
+      return 0;
+    }
+
+    void frameCompleted(Pattern *activePattern) {
+      unsigned long frameMicros = micros() - frameStartMicros;
+      ++frames;
+      ++hourFrames;
+      hourMicros += frameMicros;
+
+      // runTime() of the pattern we watched last frame must have moved forward by exactly one step
+      if (activePattern != NULL && activePattern == watchedPattern) {
+        uint32_t runTime = activePattern->runTime();
+        if (runTime - lastRunTime != stepMillis) {
+          ++glitches;
+          logf("SOAK GLITCH: %s runTime went %lu -> %lu at t=%lu", activePattern->description(), (unsigned long)lastRunTime,
+               (unsigned long)runTime, (unsigned long)gClock.millis());
+        }
+      }
+      watchedPattern = activePattern;
+      lastRunTime = activePattern ? activePattern->runTime() : 0;
+
+      struct mallinfo heap = mallinfo();
+      if (heap.uordblks > heapHighWater) {
+        heapHighWater = heap.uordblks;
+      }
+
+      uint32_t before = gClock.millis();
+      gClock.advance(stepMillis);
+      elapsedMillis += stepMillis;
+      if ((int32_t)before >= 0 && (int32_t)gClock.millis() < 0) {
+        ++wraps;
+        logf("Soak test: millis() passed 2^31 after %lu frames", frames);
+        probeWrap(0x80000000);
+      }
+      if (gClock.millis() < before) {
+        ++wraps;
+        logf("Soak test: millis() wrapped after %lu frames", frames);
+        probeWrap(0);
+      }
+
+      if (elapsedMillis >= nextReport) {
+        report(heap);
+        nextReport += 3600000;
+      }
+      frameStartMicros = micros();
+    }
+
+  private:
+    // Starts the probe at times around the wrap point and checks what Pattern makes of them
+    void probeWrap(uint32_t wrapPoint) {
+      const uint32_t starts[] = {wrapPoint - stepMillis, wrapPoint - 1, wrapPoint};
+      for (uint32_t start : starts) {
+        probeRun(start, stepMillis);
+      }
+    }
+
+    // Runs the probe from start for runMillis and checks its times
+    void probeRun(uint32_t start, uint32_t runMillis) {
+      uint32_t now = gClock.millis();
+      gClock.useVirtualTime(start);
+      probe.start();
+      if (!probe.isRunning() || probe.startedAt() != start) {
+        probeGlitch(start, runMillis, "startTime reads as not running", probe.startedAt());
+      }
+      gClock.advance(runMillis);
+      if (probe.runTime() != runMillis) {
+        probeGlitch(start, runMillis, "runTime() is wrong", probe.runTime());
+      }
+      probe.stop();
+      if (probe.stoppedAfter != runMillis) {
+        probeGlitch(start, runMillis, "stopTime - startTime is wrong", probe.stoppedAfter);
+      }
+      gClock.useVirtualTime(now);
+    }
+
+    void probeGlitch(uint32_t start, uint32_t runMillis, const char *what, uint32_t value) {
+      ++glitches;
+      logf("SOAK GLITCH: wrap probe started at %lu for %lu ms: %s (%lu)", (unsigned long)start, (unsigned long)runMillis,
+           what, (unsigned long)value);
+    }
+
+    void report(struct mallinfo &heap) {
+      float frameMicros = hourMicros / (float)hourFrames;
+      if (firstHourFrameMicros == 0) {
+        firstHourFrameMicros = frameMicros;
+      }
+      logf("Soak %luh: %lu frames, %.1f us/frame (drift %+.1f%%), heap in use %i (high water %i), %i free chunks holding %i bytes, %lu glitches, %lu wraps",
+           (unsigned long)(elapsedMillis / 3600000), frames, frameMicros, 100 * (frameMicros / firstHourFrameMicros - 1),
+           heap.uordblks, heapHighWater, heap.ordblks, heap.fordblks, glitches, wraps);
+      hourFrames = 0;
+      hourMicros = 0;
+    }
+};
+
+#endif
@@ -0,0 +1,137 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include "util.h"
+#include "clip.h"
+#include "control.h"
+
+// Host-driven frame streaming. controlStreamFrame payloads are
+//   u8 seq, u8 flags, clip ops (see clip.h) relative to the frame currently shown
+// and are decoded byte by byte as they come off the serial port, straight into the one of two frame buffers
+// that isn't being shown; skipped pixels come from the shown one (or are black in a keyframe). Once the
+// frame's CRC has checked out the buffers swap, so a frame that fails never reaches the LEDs, which keep
+// the last good one. A failed frame leaves the pendant out of step with the host's reference, so deltas are
+// refused (and NAKed, which makes the host send a keyframe) until the next keyframe. The pendant replies to
+// every frame once it's shown, so the host can keep a bounded number in flight.
+#define STREAM_FLAG_KEYFRAME 0x01
+
+class FrameStream : public ControlStreamSink {
+  private:
+    enum State {
+      readSeq, readFlags, readOp, readLiteral, readRepeat
+    } state = readSeq;
+    static const uint16_t frameBytes = NUM_LEDS * sizeof(CRGB);
+    CRGB *leds;
+    CRGB spare[NUM_LEDS];
+    // the last good frame, and the one being decoded; each is leds or spare
+    CRGB *shownFrame;
+    CRGB *decodeFrame;
+    uint16_t pos = 0;
+    uint8_t remaining = 0;
+    uint8_t op = 0;
+    bool keyframe = false;
+    bool pending = false;
+    bool inSync = false;
+
+  public:
+    uint8_t seq = 0;
+    bool active = false;
+    unsigned long lastFrameMillis = 0;
+    unsigned long frameStartMicros = 0;
+    unsigned long framesShown = 0;
+
+    FrameStream(CRGB *leds) : leds(leds), shownFrame(leds), decodeFrame(spare) { }
+
+    // What the LEDs should show while streaming
+    CRGB *shown() {
+      return shownFrame;
+    }
+
+    void begin() {
+      // a frame that never got as far as its CRC was lost, and the host's reference moved on without us
+      if (pending) {
+        inSync = false;
+      }
+      pending = true;
+      state = readSeq;
+      pos = 0;
+      keyframe = false;
+      frameStartMicros = micros();
+    }
+
+    void feed(uint8_t byte) {
+      switch (state) {
+        case readSeq:
+          seq = byte;
+          state = readFlags;
+          break;
+        case readFlags:
+          keyframe = (byte & STREAM_FLAG_KEYFRAME);
+          state = readOp;
+          break;
+        case readOp:
+          op = byte;
+          remaining = CLIP_OP_COUNT(op);
+          if ((op & 0x80) == CLIP_OP_SKIP) {
+            uint16_t end = min(frameBytes, pos + remaining);
+            if (keyframe) {
+              memset((uint8_t *)decodeFrame + pos, 0, end - pos);
+            } else {
+              memcpy((uint8_t *)decodeFrame + pos, (uint8_t *)shownFrame + pos, end - pos);
+            }
+            pos = end;
+          } else {
+            state = ((op & 0xC0) == CLIP_OP_LITERAL ? readLiteral : readRepeat);
+          }
+          break;
+        case readLiteral:
+          if (pos < frameBytes) {
+            ((uint8_t *)decodeFrame)[pos++] = byte;
+          }
+          if (--remaining == 0) {
+            state = readOp;
+          }
+          break;
+        case readRepeat:
+          for (; remaining > 0 && pos < frameBytes; --remaining) {
+            ((uint8_t *)decodeFrame)[pos++] = byte;
+          }
+          state = readOp;
+          break;
+      }
+    }
+
+    // Call once the frame's CRC has passed. Makes it the shown frame and returns true if it decoded to a
+    // whole frame against a reference that matches the host's.
+    bool commit() {
+      pending = false;
+      if (pos < frameBytes || state != readOp || !(keyframe || inSync)) {
+        inSync = false;
+        return false;
+      }
+      CRGB *decoded = decodeFrame;
+      decodeFrame = shownFrame;
+      shownFrame = decoded;
+      inSync = true;
+      return true;
+    }
+
+    // Call when the frame's CRC fails
+    void reject() {
+      pending = false;
+      inSync = false;
+    }
+
+    // Streaming starts over from a keyframe. The last frame is left in leds, for the patterns to draw over.
+    void reset() {
+      pending = false;
+      inSync = false;
+      if (shownFrame != leds) {
+        memcpy(leds, shownFrame, frameBytes);
+        decodeFrame = spare;
+        shownFrame = leds;
+      }
+    }
+};
+
+#endif
@@ -0,0 +1,185 @@
+#!/usr/bin/env python3
+# Streams frames from the host straight into the pendant's LED buffer (see stream.h).
+#
+#   ./stream.py /dev/ttyACM0                      built-in test animation
+#   ./stream.py /dev/ttyACM0 --capture run.log    replay a CLIP_RECORD or GOLDEN_CAPTURE log
+#   ./stream.py --loopback                        run against an emulated pendant on a pseudo-terminal
+#
+# The loopback pendant is a Python model of FrameStream, so it checks this script's encoding, windowing
+# and acks, not the firmware's decoder. emu.py check stream tests the decoder itself, and the pty that
+# emu.py run --pty prints can stand in for a pendant's port here.
+#
+# Frames are delta coded against the previous one with the clip ops from clip_compiler.py. At most
+# --window frames are in flight; each is acknowledged once shown. Reports sustained frames/s and
+# send-to-ack latency.
+import argparse
+import math
+import os
+import pty
+import struct
+import sys
+import threading
+import time
+import tty
+
+from clip_compiler import encode_frame
+from control import FrameReader, NAK, REPLY, frame, open_port
+from render import read_frames
+
+STREAM_FRAME = 0x07
+STREAM_END = 0x08
+FLAG_KEYFRAME = 0x01
+NUM_LEDS = 48
+
+def test_animation(count):
+	for n in range(count):
+		frame_bytes = bytearray()
+		for i in range(NUM_LEDS):
+			v = int(127 + 127 * math.sin(n * 0.05 + i * 0.4))
+			frame_bytes += bytes((v, 255 - v, (i * 16 + n) & 0xFF))
+		yield bytes(frame_bytes)
+
+def capture_frames(path, pattern):
+	for _, frame_bytes in read_frames(path, pattern):
+		yield frame_bytes
+
+class EmulatedPendant(threading.Thread):
+	"""Decodes stream frames like FrameStream and acknowledges them, for --loopback. A model, not the firmware."""
+	def __init__(self, fd):
+		threading.Thread.__init__(self)
+		self.daemon = True
+		self.fd = fd
+		self.leds = bytearray(NUM_LEDS * 3)
+		self.shown = []
+
+	def run(self):
+		reader = FrameReader(self.fd, False)
+		while True:
+			result = reader.read(5)
+			if result is None:
+				return
+			command, payload = result
+			if command == STREAM_END:
+				os.write(self.fd, frame(STREAM_END | REPLY))
+				continue
+			start = time.time()
+			seq, flags = payload[0], payload[1]
+			if flags & FLAG_KEYFRAME:
+				self.leds[:] = bytes(len(self.leds))
+			self.decode(payload[2:])
+			self.shown.append(bytes(self.leds))
+			micros = int((time.time() - start) * 1e6) & 0xFFFF
+			os.write(self.fd, frame(STREAM_FRAME | REPLY, struct.pack("<BH", seq, micros)))
+
+	def decode(self, ops):
+		pos = 0
+		i = 0
+		while i < len(ops):
+			op = ops[i]
+			i += 1
+			if op < 0x80:
+				pos += op + 1
+			elif op < 0xC0:
+				count = (op & 0x3F) + 1
+				self.leds[pos:pos + count] = ops[i:i + count]
+				i += count
+				pos += count
+			else:
+				count = (op & 0x3F) + 1
+				self.leds[pos:pos + count] = bytes([ops[i]]) * count
+				i += 1
+				pos += count
+
+def percentile(values, p):
+	values = sorted(values)
+	return values[min(len(values) - 1, int(p / 100.0 * len(values)))] if values else 0
+
+def main():
+	parser = argparse.ArgumentParser()
+	parser.add_argument("port", nargs="?")
+	parser.add_argument("--capture", help="Capture log to replay instead of the test animation")
+	parser.add_argument("--pattern", help="Pattern to replay from a golden log")
+	parser.add_argument("--frames", type=int, default=2000, help="Frames of test animation to send")
+	parser.add_argument("--fps", type=float, default=0, help="Pace frames at this rate (default: as fast as acks allow)")
+	parser.add_argument("--window", type=int, default=4, help="Frames in flight before waiting for an ack")
+	parser.add_argument("--baud", type=int, default=57600)
+	parser.add_argument("--loopback", action="store_true", help="Stream to a Python model of the pendant's decoder on a pseudo-terminal (tests this script, not the firmware)")
+	args = parser.parse_args()
+
+	pendant = None
+	if args.loopback:
+		master, slave = pty.openpty()
+		tty.setraw(slave)
+		pendant = EmulatedPendant(master)
+		pendant.start()
+		fd = slave
+	elif args.port:
+		fd = open_port(args.port, args.baud)
+	else:
+		parser.error("give a port or --loopback")
+
+	frames = capture_frames(args.capture, args.pattern) if args.capture else test_animation(args.frames)
+	reader = FrameReader(fd, False)
+	sent_at = {}
+	latencies = []
+	device_micros = []
+	sent = []
+	previous = None
+	keyframe = True
+	seq = 0
+	payload_bytes = 0
+	start = time.time()
+
+	def wait_for_ack(timeout):
+		nonlocal keyframe
+		result = reader.read(timeout)
+		if result is None:
+			return False
+		command, data = result
+		if command == STREAM_FRAME | REPLY:
+			ack_seq, micros = struct.unpack("<BH", data[:3])
+			if ack_seq in sent_at:
+				latencies.append(time.time() - sent_at.pop(ack_seq))
+				device_micros.append(micros)
+		elif command == NAK and data[0] == STREAM_FRAME:
+			# the pendant's buffer no longer matches ours, so the next frame must stand alone
+			keyframe = True
+			sent_at.clear()
+		return True
+
+	for frame_bytes in frames:
+		while len(sent_at) >= args.window:
+			if not wait_for_ack(1.0):
+				sys.exit("pendant stopped acknowledging frames")
+		if args.fps:
+			due = start + len(sent) / args.fps
+			while time.time() < due:
+				wait_for_ack(max(0, due - time.time()))
+		reference = bytes(len(frame_bytes)) if keyframe or previous is None else previous
+		ops = encode_frame(reference, frame_bytes)
+		payload = struct.pack("<BB", seq, FLAG_KEYFRAME if keyframe else 0) + ops
+		assert len(payload) <= 255, "frame too large to stream"
+		sent_at[seq] = time.time()
+		os.write(fd, frame(STREAM_FRAME, payload))
+		payload_bytes += len(payload) + 4
+		sent.append(frame_bytes)
+		previous = frame_bytes
+		keyframe = False
+		seq = (seq + 1) & 0xFF
+	while sent_at and wait_for_ack(1.0):
+		pass
+	elapsed = time.time() - start
+	os.write(fd, frame(STREAM_END))
+
+	print("{} frames in {:.2f} s: {:.0f} frames/s, {:.0f} bytes/frame on the wire".format(
+		len(sent), elapsed, len(sent) / elapsed, payload_bytes / float(max(1, len(sent)))))
+	if latencies:
+		print("send-to-ack latency: p50 {:.2f} ms, p95 {:.2f} ms, max {:.2f} ms; pendant decode+show {:.0f} us avg".format(
+			1000 * percentile(latencies, 50), 1000 * percentile(latencies, 95), 1000 * max(latencies), sum(device_micros) / float(len(device_micros))))
+	if pendant:
+		time.sleep(0.1)
+		mismatches = sum(1 for a, b in zip(sent, pendant.shown) if a != b)
+		print("loopback: {} frames shown, {} mismatches".format(len(pendant.shown), mismatches + abs(len(sent) - len(pendant.shown))))
+
+if __name__ == "__main__":
+	main()
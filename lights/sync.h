@@ -0,0 +1,279 @@
+#ifndef SYNC_H
+#define SYNC_H
+
+#include "util.h"
+#include "control.h"
+
+// Keeps several pendants on one time base, pattern and RNG seed. The node with the lowest id leads and
+// broadcasts a beacon every kSyncBeaconMillis; everyone else only listens, so the link carries 20 bytes
+// a second however many pendants there are:
+//   'B' u16 nodeId  u32 millis  u8 pattern  u16 seed
+// A follower that is tapped asks the leader for the next pattern instead of changing on its own:
+//   'R' u16 nodeId  u8 pattern  u16 seed
+// Followers fit a line through their last few (local time, leader offset) samples, which corrects
+// for the crystals running at slightly different rates as well as for the offset.
+#define SYNC_MESSAGE_MAX 10
+#define SYNC_BEACON 'B'
+#define SYNC_REQUEST 'R'
+#define SYNC_NO_LEADER 0xFFFF
+
+const uint32_t kSyncBeaconMillis = 500;
+// a leader that has been quiet this long is gone, and the lowest id left takes over
+const uint32_t kSyncLeaderTimeout = 4 * kSyncBeaconMillis;
+// a beacon this far from the fitted line means the leader's clock jumped, so start the fit again
+const int32_t kSyncResyncMillis = 50;
+const uint8_t kSyncSamples = 8;
+// fewer samples than this can't tell drift from millis() quantization, so only the offset is used
+const uint8_t kSyncMinDriftSamples = 4;
+const float kSyncMaxDrift = 500e-6;
+
+// Carries whole messages to every other pendant in range. Delivery can be lossy.
+class SyncTransport {
+  public:
+    virtual ~SyncTransport() { }
+    virtual void send(const uint8_t *message, uint8_t length) = 0;
+    // Copies the next received message into message and returns its length, or 0 if there is none
+    virtual uint8_t receive(uint8_t *message) = 0;
+    // Typical delay from send() on one pendant to receive() on another, added to received timestamps
+    virtual uint16_t latencyMillis() = 0;
+};
+
+// Messages framed as the control protocol's are, over a UART (e.g. a transparent serial radio module)
+template<class Port>
+class SerialTransport : public SyncTransport {
+  private:
+    Port &port;
+    uint32_t baud;
+    ControlParser parser;
+
+  public:
+    SerialTransport(Port &port, uint32_t baud) : port(port), baud(baud) { }
+
+    void begin() {
+      port.begin(baud);
+    }
+
+    void send(const uint8_t *message, uint8_t length) {
+      uint8_t header[3] = {CONTROL_SOF, message[0], (uint8_t)(length - 1)};
+      uint8_t crc = crc8Update(crc8Update(0, header[1]), header[2]);
+      for (uint8_t i = 1; i < length; ++i) {
+        crc = crc8Update(crc, message[i]);
+      }
+      port.write(header, sizeof(header));
+      port.write(message + 1, length - 1);
+      port.write(crc);
+    }
+
+    uint8_t receive(uint8_t *message) {
+      while (port.available() > 0) {
+        if (parser.feed(port.read()) && parser.crcOK && parser.length < SYNC_MESSAGE_MAX) {
+          message[0] = parser.command;
+          memcpy(message + 1, parser.payload, parser.length);
+          return parser.length + 1;
+        }
+      }
+      parser.idle();
+      return 0;
+    }
+
+    uint16_t latencyMillis() {
+      // 10 bits per byte for a full beacon frame
+      return (SYNC_MESSAGE_MAX + 3) * 10 * 1000 / baud;
+    }
+};
+
+class SyncNode {
+  private:
+    struct Sample {
+      uint32_t local;
+      int32_t offset;
+    } samples[kSyncSamples];
+    uint8_t sampleCount = 0;
+    uint8_t nextSample = 0;
+
+    // synced = local + offset + drift * (local - reference)
+    int32_t offset = 0;
+    float drift = 0;
+    uint32_t reference = 0;
+
+    SyncTransport *transport;
+    uint32_t startLocal = 0;
+    uint32_t lastLeaderBeacon = 0;
+    uint32_t lastBeaconSent = 0;
+    bool started = false;
+    bool beaconDue = false;
+    // a follower's request is sent again with each beacon that doesn't carry it yet, in case it was lost
+    uint8_t requestRetries = 0;
+    uint8_t request[6] = {SYNC_REQUEST};
+
+  public:
+    uint16_t nodeId;
+    uint16_t leaderId = SYNC_NO_LEADER;
+    // what every pendant should be running
+    uint8_t pattern = 0;
+    uint16_t seed = 0;
+
+    unsigned long messagesSent = 0;
+    unsigned long messagesReceived = 0;
+    unsigned long bytesSent = 0;
+
+    SyncNode(SyncTransport *transport, uint16_t nodeId) : transport(transport), nodeId(nodeId) { }
+
+    bool isLeader() {
+      return leaderId == nodeId;
+    }
+
+    // following a leader, or leading
+    bool isSynced() {
+      return leaderId != SYNC_NO_LEADER;
+    }
+
+    uint32_t millis(uint32_t local) {
+      return local + offset + (int32_t)(drift * (int32_t)(local - reference));
+    }
+
+    // Asks for a pattern change. Returns true if it applies right away; otherwise the leader's
+    // next beacon brings it, and poll() returns true then.
+    bool setPattern(uint8_t pattern, uint16_t seed) {
+      if (isSynced() && !isLeader()) {
+        put16(request + 1, nodeId);
+        request[3] = pattern;
+        put16(request + 4, seed);
+        send(request, sizeof(request));
+        requestRetries = 3;
+        return false;
+      }
+      this->pattern = pattern;
+      this->seed = seed;
+      beaconDue = true;
+      return true;
+    }
+
+    // Call every frame with the hardware millis(). Returns true when pattern and seed were changed by another pendant.
+    bool poll(uint32_t local) {
+      if (!started) {
+        started = true;
+        startLocal = lastLeaderBeacon = local;
+      }
+      bool changed = false;
+      uint8_t message[SYNC_MESSAGE_MAX];
+      uint8_t length;
+      while ((length = transport->receive(message)) != 0) {
+        ++messagesReceived;
+        if (message[0] == SYNC_BEACON && length == 10) {
+          changed |= receiveBeacon(message, local);
+        } else if (message[0] == SYNC_REQUEST && length == 6 && isLeader()) {
+          changed |= setPattern(message[3], get16(message + 4));
+        }
+      }
+
+      // claim the lead if nobody lower has been heard from, after listening long enough to hear an existing group
+      if (!isLeader() && local - lastLeaderBeacon > kSyncLeaderTimeout && local - startLocal > kSyncLeaderTimeout) {
+        leaderId = nodeId;
+        sampleCount = 0;
+        beaconDue = true;
+      }
+      if (isLeader() && (beaconDue || local - lastBeaconSent >= kSyncBeaconMillis)) {
+        uint8_t beacon[10] = {SYNC_BEACON};
+        put16(beacon + 1, nodeId);
+        put32(beacon + 3, millis(local));
+        beacon[7] = pattern;
+        put16(beacon + 8, seed);
+        send(beacon, sizeof(beacon));
+        lastBeaconSent = local;
+        beaconDue = false;
+      }
+      return changed;
+    }
+
+  private:
+    bool receiveBeacon(const uint8_t *message, uint32_t local) {
+      uint16_t sender = get16(message + 1);
+      if (sender > leaderId || (sender == leaderId && isLeader())) {
+        return false;
+      }
+      if (sender < leaderId) {
+        // a lower id takes over, including from us
+        leaderId = sender;
+        sampleCount = 0;
+      }
+      lastLeaderBeacon = local;
+      addSample(local, get32(message + 3) + transport->latencyMillis() - local);
+
+      bool changed = (message[7] != pattern || get16(message + 8) != seed);
+      pattern = message[7];
+      seed = get16(message + 8);
+      if (requestRetries) {
+        if (pattern == request[3] && seed == get16(request + 4)) {
+          requestRetries = 0;
+        } else {
+          send(request, sizeof(request));
+          --requestRetries;
+        }
+      }
+      if (sender > nodeId) {
+        // we outrank this leader; take over now that we share its time base and pattern, so nobody jumps
+        leaderId = nodeId;
+        beaconDue = true;
+      }
+      return changed;
+    }
+
+    void addSample(uint32_t local, int32_t sampleOffset) {
+      if (sampleCount > 0 && abs((int32_t)(local + sampleOffset - millis(local))) > kSyncResyncMillis) {
+        sampleCount = 0;
+      }
+      if (sampleCount == 0) {
+        nextSample = 0;
+      }
+      samples[nextSample] = {local, sampleOffset};
+      nextSample = (nextSample + 1) % kSyncSamples;
+      sampleCount = min(sampleCount + 1, kSyncSamples);
+
+      // least squares fit of offset against local time, relative to the newest sample to keep floats small
+      float sumX = 0, sumY = 0, sumXX = 0, sumXY = 0;
+      for (uint8_t i = 0; i < sampleCount; ++i) {
+        float x = (int32_t)(samples[i].local - local);
+        float y = samples[i].offset - sampleOffset;
+        sumX += x;
+        sumY += y;
+        sumXX += x * x;
+        sumXY += x * y;
+      }
+      float meanX = sumX / sampleCount;
+      float meanY = sumY / sampleCount;
+      float variance = sumXX / sampleCount - meanX * meanX;
+      drift = 0;
+      if (sampleCount >= kSyncMinDriftSamples && variance > 0) {
+        drift = constrain((sumXY / sampleCount - meanX * meanY) / variance, -kSyncMaxDrift, kSyncMaxDrift);
+      }
+      reference = local;
+      offset = sampleOffset + (int32_t)roundf(meanY - drift * meanX);
+    }
+
+    void send(const uint8_t *message, uint8_t length) {
+      transport->send(message, length);
+      ++messagesSent;
+      bytesSent += length;
+    }
+
+    static void put16(uint8_t *p, uint16_t v) {
+      p[0] = v & 0xFF;
+      p[1] = v >> 8;
+    }
+
+    static void put32(uint8_t *p, uint32_t v) {
+      put16(p, v & 0xFFFF);
+      put16(p + 2, v >> 16);
+    }
+
+    static uint16_t get16(const uint8_t *p) {
+      return p[0] | (p[1] << 8);
+    }
+
+    static uint32_t get32(const uint8_t *p) {
+      return get16(p) | ((uint32_t)get16(p + 2) << 16);
+    }
+};
+
+#endif
@@ -0,0 +1,221 @@
+#ifndef SYNCSIM_H
+#define SYNCSIM_H
+
+#include "util.h"
+#include "sync.h"
+
+// In-process stand-in for a radio link. Every message one node sends is queued for each of the others
+// with a latency, random jitter and loss; the simulation moves now forward.
+class LoopbackBus {
+  private:
+    struct Message {
+      uint32_t deliverAt;
+      uint8_t length;
+      uint8_t bytes[SYNC_MESSAGE_MAX];
+    };
+    static const uint8_t kQueueLength = 8;
+    Message *queues;
+    uint8_t *queued;
+    uint8_t nodeCount;
+
+  public:
+    uint32_t now = 0;
+    uint16_t latency;
+    uint16_t jitter;
+    uint8_t lossPercent;
+    unsigned long bytesCarried = 0;
+    unsigned long dropped = 0;
+
+    LoopbackBus(uint8_t nodeCount, uint16_t latency, uint16_t jitter, uint8_t lossPercent)
+      : nodeCount(nodeCount), latency(latency), jitter(jitter), lossPercent(lossPercent) {
+      queues = new Message[nodeCount * kQueueLength];
+      queued = new uint8_t[nodeCount]();
+    }
+
+    ~LoopbackBus() {
+      delete[] queues;
+      delete[] queued;
+    }
+
+    void post(uint8_t from, const uint8_t *bytes, uint8_t length) {
+      bytesCarried += length;
+      for (uint8_t to = 0; to < nodeCount; ++to) {
+        if (to == from) {
+          continue;
+        }
+        if (random8(100) < lossPercent || queued[to] == kQueueLength) {
+          ++dropped;
+          continue;
+        }
+        Message &message = queues[to * kQueueLength + queued[to]++];
+        message.deliverAt = now + latency - jitter / 2 + random16(jitter + 1);
+        message.length = length;
+        memcpy(message.bytes, bytes, length);
+      }
+    }
+
+    uint8_t take(uint8_t to, uint8_t *bytes) {
+      Message *queue = &queues[to * kQueueLength];
+      for (uint8_t i = 0; i < queued[to]; ++i) {
+        if ((int32_t)(now - queue[i].deliverAt) >= 0) {
+          uint8_t length = queue[i].length;
+          memcpy(bytes, queue[i].bytes, length);
+          queue[i] = queue[--queued[to]];
+          return length;
+        }
+      }
+      return 0;
+    }
+};
+
+class LoopbackTransport : public SyncTransport {
+  private:
+    LoopbackBus *bus;
+    uint8_t slot;
+
+  public:
+    LoopbackTransport(LoopbackBus *bus, uint8_t slot) : bus(bus), slot(slot) { }
+
+    void send(const uint8_t *message, uint8_t length) {
+      bus->post(slot, message, length);
+    }
+
+    uint8_t receive(uint8_t *message) {
+      return bus->take(slot, message);
+    }
+
+    uint16_t latencyMillis() {
+      return bus->latency;
+    }
+};
+
+// Runs nodeCount SyncNodes in simulated time over a LoopbackBus, each with its own clock offset, crystal
+// error and boot time, with a tap on a random pendant every so often. Reports how long the group takes
+// to agree on the time, the error left after that, and how fast pattern changes spread. SYNC_SIMULATION
+// runs it at boot on a pendant, and emu.py sync runs the same build on the host.
+void runSyncSimulation(uint8_t nodeCount, uint32_t seconds, uint16_t latency, uint16_t jitter, uint8_t lossPercent, uint16_t seed) {
+  const uint32_t kMaxBootMillis = 5000;
+  const int kMaxDriftPpm = 100;
+  const uint32_t kSampleMillis = 10;
+  const int32_t kConvergedMillis = 5;
+  const uint32_t kTapMillis = 15000;
+
+  random16_set_seed(seed);
+  logf("Sync simulation: %u pendants for %lu s, link latency %u +/- %u ms with %u%% loss",
+       nodeCount, (unsigned long)seconds, latency, jitter / 2, lossPercent);
+
+  LoopbackBus bus(nodeCount, latency, jitter, lossPercent);
+  LoopbackTransport **transports = new LoopbackTransport *[nodeCount];
+  SyncNode **nodes = new SyncNode *[nodeCount];
+  uint32_t *clockOffset = new uint32_t[nodeCount];
+  int *driftPpm = new int[nodeCount];
+  uint32_t *bootAt = new uint32_t[nodeCount];
+  uint32_t lastBoot = 0;
+  uint8_t lowest = 0;
+  for (uint8_t i = 0; i < nodeCount; ++i) {
+    transports[i] = new LoopbackTransport(&bus, i);
+    nodes[i] = new SyncNode(transports[i], (random16(1, SYNC_NO_LEADER - 1) & ~0xFF) | i);
+    clockOffset[i] = ((uint32_t)random16() << 16) | random16();
+    driftPpm[i] = random16(2 * kMaxDriftPpm + 1) - kMaxDriftPpm;
+    bootAt[i] = random16(kMaxBootMillis);
+    lastBoot = max(lastBoot, bootAt[i]);
+    if (nodes[i]->nodeId < nodes[lowest]->nodeId) {
+      lowest = i;
+    }
+  }
+  auto local = [&](uint8_t i, uint32_t t) {
+    return clockOffset[i] + t + (int32_t)((int64_t)t * driftPpm[i] / 1000000);
+  };
+
+  uint32_t convergedAt = 0;
+  unsigned long samples = 0;
+  unsigned long outside = 0;
+  float sumSquares = 0;
+  int32_t maxError = 0;
+  int32_t windowMaxError = 0;
+  uint8_t wantPattern = 0;
+  uint16_t wantSeed = 0;
+  uint32_t tapAt = 0;
+  bool waiting = false;
+  unsigned long changes = 0;
+  unsigned long lostTaps = 0;
+  uint32_t changeMillisTotal = 0;
+  uint32_t changeMillisMax = 0;
+
+  uint32_t end = seconds * 1000;
+  for (uint32_t t = 0; t < end; ++t) {
+    bus.now = t;
+    for (uint8_t i = 0; i < nodeCount; ++i) {
+      if (t >= bootAt[i]) {
+        nodes[i]->poll(local(i, t));
+      }
+    }
+
+    if (t > lastBoot && t % kTapMillis == 0) {
+      if (waiting) {
+        ++lostTaps;
+      }
+      SyncNode *tapped = nodes[random8(nodeCount)];
+      wantPattern = tapped->pattern + 1;
+      wantSeed = random16();
+      tapped->setPattern(wantPattern, wantSeed);
+      tapAt = t;
+      waiting = true;
+    }
+
+    if (t < lastBoot || t % kSampleMillis != 0) {
+      continue;
+    }
+    uint32_t reference = nodes[lowest]->millis(local(lowest, t));
+    int32_t worst = 0;
+    bool agreed = true;
+    for (uint8_t i = 0; i < nodeCount; ++i) {
+      SyncNode *node = nodes[i];
+      int32_t error = node->millis(local(i, t)) - reference;
+      worst = max(worst, abs(error));
+      agreed &= (node->pattern == wantPattern && node->seed == wantSeed);
+    }
+    if (convergedAt == 0 && worst <= kConvergedMillis) {
+      convergedAt = t;
+    }
+    if (convergedAt) {
+      ++samples;
+      outside += (worst > kConvergedMillis);
+      sumSquares += (float)worst * worst;
+      maxError = max(maxError, worst);
+    }
+    windowMaxError = max(windowMaxError, worst);
+    if (waiting && agreed) {
+      waiting = false;
+      ++changes;
+      changeMillisTotal += t - tapAt;
+      changeMillisMax = max(changeMillisMax, t - tapAt);
+    }
+    if ((t - lastBoot) / kSampleMillis % 1000 == 0) {
+      logf("  t=%lus leader %04x, worst error over the last 10 s %li ms", (unsigned long)(t / 1000), nodes[lowest]->nodeId, (long)windowMaxError);
+      windowMaxError = 0;
+    }
+  }
+
+  if (convergedAt) {
+    logf("Converged to within %li ms %lu ms after the last pendant booted; after that worst error %li ms, rms %.2f ms, %.2f%% of the time outside",
+         (long)kConvergedMillis, (unsigned long)(convergedAt - lastBoot), (long)maxError, sqrtf(sumSquares / samples), 100.0 * outside / samples);
+  } else {
+    logf("Did not converge to within %li ms", (long)kConvergedMillis);
+  }
+  logf("Pattern changes reached every pendant in %lu ms on average, %lu ms worst; %lu of %lu taps lost",
+       changes ? (unsigned long)(changeMillisTotal / changes) : 0, (unsigned long)changeMillisMax, lostTaps, changes + lostTaps);
+  logf("Link: %.1f bytes/s sent in total, %lu deliveries dropped", bus.bytesCarried / (float)seconds, bus.dropped);
+
+  for (uint8_t i = 0; i < nodeCount; ++i) {
+    delete nodes[i];
+    delete transports[i];
+  }
+  delete[] nodes;
+  delete[] transports;
+  delete[] clockOffset;
+  delete[] driftPpm;
+  delete[] bootAt;
+}
+
+#endif
@@ -28,6 +28,78 @@ inline float fmod_wrap(float x, int m) {
   return result < 0 ? result + m : result;
 }
 
+// Pattern time. Normally the hardware millis(), shifted onto the time base shared with other pendants
+// when they are synced (see sync.h), but harnesses can switch to a virtual clock that only moves when
+// advanced. FastLED's beat and EVERY_N helpers read it too, via get_millisecond_timer().
+class Clock {
+  private:
+    bool isVirtual = false;
+    uint32_t virtualMillis = 0;
+    int32_t offset = 0;
+  public:
+    uint32_t millis() {
+      return isVirtual ? virtualMillis : ::millis() + offset;
+    }
+    void setOffset(int32_t offset) {
+      this->offset = offset;
+    }
+    void useVirtualTime(uint32_t start) {
+      isVirtual = true;
+      virtualMillis = start;
+    }
+    void useRealTime() {
+      isVirtual = false;
+    }
+    void advance(uint32_t ms) {
+      virtualMillis += ms;
+    }
+};
+
+Clock gClock;
+
+// Whole frames at MAX_FRAMERATE in the time since the last call. Patterns with per-frame steps tuned at the
+// full rate (fades, dice) take that many steps a frame, so they fade and fire as fast in real time when the
+// power governor slows the frames down.
+class FrameSteps {
+  private:
+    uint32_t last = 0;
+    uint32_t carry = 0;
+  public:
+    void reset(uint32_t now) {
+      last = now;
+      carry = 0;
+    }
+    // At most maxSteps, however long it's been: pass the count after which more steps change nothing
+    uint16_t elapsed(uint32_t now, uint16_t maxSteps) {
+      int32_t delta = now - last;
+      last = now;
+      // SYNC moves gClock back when it adopts an earlier time base; that's no frames, not four billion ms
+      if (delta <= 0) {
+        return 0;
+      }
+      // count no further than the cap, so a long stall can't overflow the multiply
+      uint32_t capMillis = (uint32_t)maxSteps * 1000 / MAX_FRAMERATE + 1;
+      carry += min((uint32_t)delta, capMillis) * MAX_FRAMERATE;
+      uint32_t steps = carry / 1000;
+      carry -= steps * 1000;
+      if (steps >= maxSteps) {
+        carry = 0;
+        return maxSteps;
+      }
+      return steps;
+    }
+};
+
+// How many fadeToBlackBy(fadeBy) calls take a full channel to black, with FastLED's scale8 (x * (1 + scale)
+// >> 8): the most steps a per-frame fade ever needs to catch up
+constexpr uint16_t fadeStepsToBlack(uint8_t fadeBy, uint8_t value = 255) {
+  return value == 0 || fadeBy == 0 ? 0 : 1 + fadeStepsToBlack(fadeBy, (uint16_t)value * (256 - fadeBy) >> 8);
+}
+
+uint32_t get_millisecond_timer() {
+  return gClock.millis();
+}
+
 class FrameCounter {
   private:
     long lastPrint = 0;
@@ -35,12 +107,14 @@ class FrameCounter {
     long lastClamp = 0;
   public:
     long printInterval = 2000;
+    float framerate = 0;
     void tick() {
       unsigned long mil = millis();
       long elapsed = mil - lastPrint;
       if (elapsed > printInterval) {
         if (lastPrint != 0) {
-          logf("Framerate: %f", frames / (float)elapsed * 1000);
+          framerate = frames / (float)elapsed * 1000;
+          logf("Framerate: %f", framerate);
         }
         frames = 0;
         lastPrint = mil;
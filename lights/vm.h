@@ -0,0 +1,968 @@
+#ifndef VM_H
+#define VM_H
+
+#include <FastLED.h>
+#include "util.h"
+#include "patterns.h"
+#include "cycles.h"
+
+// Pattern bytecode, so new looks can be uploaded over the control protocol (or added to vm_programs.h)
+// instead of being compiled in. Programs are written for vm_asm.py, which builds vm_programs.h from
+// programs.vm and uploads them.
+//
+// The machine is a stack machine whose values are either scalars (32 bit, per frame) or vectors of one
+// 16 bit lane per LED. Every instruction works on whole values, so dispatch happens once per op per
+// frame rather than once per op per pixel, and each op's loop over the lanes is an ordinary native
+// kernel. Binary ops take any mix of the two: a scalar operand applies to every lane (as its low 16 bits).
+// Programs run once per frame from the top; the only control flow is a forward jump, and per-frame state
+// lives in registers, timers, oscillators from the shared bank and the particle pool.
+//
+// Program layout:
+//   u8 'V', u8 version, u8 flags (VMFlags), u8 palette (0xFF random), u16 frame rate (0 for MAX_FRAMERATE),
+//   u8 name length, name, u8 oscillator count, per oscillator u8 shape, i16 bpm88, u16 low, u16 high,
+//   then code to the end of the program.
+// A program is verified (operands, stack depth and value types, jump targets) before it runs, so the
+// interpreter itself doesn't check anything. With the palette flag, register 0 starts out as the number of
+// the gradient palette loaded into the target palette.
+#define VM_MAGIC 'V'
+#define VM_VERSION 1
+#define VM_PROGRAM_BYTES 256
+#define VM_NAME_BYTES 23
+#define VM_MAX_OSCILLATORS 6
+#define VM_STACK_DEPTH 8
+#define VM_MAX_VECTORS 3
+#define VM_MAX_NESTING 4
+#define VM_REGISTERS 8
+#define VM_TIMERS 4
+#define VM_PARTICLES 8
+
+enum VMOp : uint8_t {
+  // per frame values
+  vmPush8 = 0x01,        // u8 value
+  vmPush16 = 0x02,       // i16 value
+  vmLoad = 0x03,         // u8 register
+  vmStore = 0x04,        // u8 register; pops a scalar
+  vmOsc = 0x05,          // u8 oscillator -> its value
+  vmMillis = 0x06,       // -> gClock.millis()
+  vmRunTime = 0x07,      // -> runTime()
+  vmRandom8 = 0x08,      // n -> random8(n)
+  vmEvery = 0x09,        // u8 timer, u16 period ms -> 1 once the period has passed since the timer last fired, else 0
+  vmJumpIfZero = 0x0A,   // u8 forward offset; pops a scalar
+  vmDup = 0x0B,
+  vmDrop = 0x0C,
+  vmSwap = 0x0D,
+  vmDiv = 0x0E,          // a b -> a / b (0 if b is 0), signed
+  vmMod = 0x0F,          // a b -> a % b (0 if b is 0), signed
+  vmLess = 0x10,         // a b -> a < b, signed
+  vmSelect = 0x11,       // a b c -> c ? a : b
+  vmPaletteCount = 0x12, // -> number of gradient palettes
+  // lane by lane
+  vmAdd = 0x20,
+  vmSub = 0x21,
+  vmMul = 0x22,
+  vmMulHi = 0x23,        // (a * b) >> 16 of the low 16 bits
+  vmMin = 0x24,
+  vmMax = 0x25,
+  vmAnd = 0x26,
+  vmScale8 = 0x27,       // scale8(a, b)
+  vmShr = 0x28,          // u8 bits
+  vmShl = 0x29,          // u8 bits
+  vmSin8 = 0x2A,         // sin8()
+  vmSin16 = 0x2B,        // sin16() + 32768
+  vmFold = 0x2C,         // 16 bit sawtooth -> 0..127..0 triangle
+  // vectors
+  vmRamp = 0x30,         // base step -> lanes base + i * step
+  vmReverse = 0x31,      // lane i <-> lane NUM_LEDS - 1 - i
+  // whole buffer output
+  vmColor = 0x40,        // index level mix -> nblend palette colors over leds
+  vmHsv = 0x41,          // hue level mix -> nblend fully saturated hues over leds
+  vmFade = 0x42,         // amount -> leds.fadeToBlackBy()
+  vmPalette = 0x43,      // n -> gradient palette n (mod count) becomes the target palette
+  vmPaletteBlend = 0x44, // changes -> nblendPaletteTowardPalette(current, target, changes)
+  vmSpawn = 0x45,        // index speed -> a particle at a random pixel, moving at speed pixels/s
+  vmParticles = 0x46,    // lifespan ms -> move and draw the particles, retiring those older than lifespan
+};
+
+enum VMFlags : uint8_t {
+  vmUsesPalette = 0x01,
+  vmUsesParticles = 0x02,
+};
+
+struct VMProgram {
+  const uint8_t *data;
+  uint16_t length;
+};
+
+#include "vm_programs.h"
+
+// Header fields of a verified program
+struct VMHeader {
+  uint8_t flags;
+  uint8_t palette;
+  uint16_t framerate;
+  const char *name;
+  uint8_t nameLength;
+  uint8_t oscillatorCount;
+  const uint8_t *oscillators;
+  const uint8_t *code;
+  uint16_t codeLength;
+  uint8_t maxVectors;
+};
+
+struct VMParticle {
+  uint16_t position; // 8.8 fixed point pixels
+  uint16_t birth;
+  int8_t speed;
+  uint8_t index;
+  bool alive;
+};
+
+class VMPattern : public Pattern {
+  private:
+    struct Slot {
+      uint32_t scalar;
+      uint16_t *lanes; // NULL for a scalar
+    };
+
+    // flash is memory mapped on the Teensy, so programs run from flash and RAM alike
+    const VMProgram *const *programs;
+    uint8_t programCount;
+    // an upload lands in incoming, so the current one keeps running until the new one has verified
+    uint8_t uploadBuffers[2][VM_PROGRAM_BYTES];
+    uint8_t *uploaded = uploadBuffers[0];
+    uint8_t *incoming = uploadBuffers[1];
+    uint16_t uploadedLength = 0;
+    uint16_t incomingLength = 0;
+    bool receiving = false;
+    bool uploadReady = false;
+
+    // the loaded program, which code points into past its header
+    const uint8_t *program = NULL;
+    const uint8_t *code = NULL;
+    uint16_t codeLength = 0;
+    uint8_t flags = 0;
+    uint16_t programFramerate = MAX_FRAMERATE;
+    char name[VM_NAME_BYTES + 4] = "VM";
+    int8_t oscillators[VM_MAX_OSCILLATORS];
+    uint32_t registers[VM_REGISTERS];
+    uint32_t timers[VM_TIMERS];
+    uint32_t particleMillis = 0;
+
+    uint16_t *vectors = NULL;
+    uint8_t freeVectors = 0;
+    CRGBPalette16 *currentPalette = NULL;
+    CRGBPalette16 *targetPalette = NULL;
+    VMParticle *particles = NULL;
+    uint8_t vectorCount = 0;
+    Slot stack[VM_STACK_DEPTH];
+    uint8_t depth = 0;
+
+  public:
+    static const size_t kScratchBytes = scratchSize(VM_MAX_VECTORS * NUM_LEDS * sizeof(uint16_t)) +
+                                        2 * scratchSize(sizeof(CRGBPalette16)) +
+                                        scratchSize(VM_PARTICLES * sizeof(VMParticle));
+
+    size_t scratchBytes() {
+      return kScratchBytes;
+    }
+
+    VMPattern(const VMProgram *const *programs, uint8_t programCount) : programs(programs), programCount(programCount) { }
+
+    // Variants are the flash programs, then the uploaded one if there is one
+    uint16_t variantCount() {
+      return programCount + (uploadReady ? 1 : 0);
+    }
+
+    // Takes the next chunk of a program uploaded over the control protocol. Returns false if it doesn't
+    // fit, or if the last chunk completes a program that doesn't verify; the previous upload stays either way.
+    bool receive(const uint8_t *bytes, uint8_t length, bool first, bool last) {
+      if (first) {
+        receiving = true;
+        incomingLength = 0;
+      }
+      if (!receiving || incomingLength + length > VM_PROGRAM_BYTES) {
+        receiving = false;
+        return false;
+      }
+      memcpy(incoming + incomingLength, bytes, length);
+      incomingLength += length;
+      if (!last) {
+        return true;
+      }
+      receiving = false;
+      VMHeader header;
+      if (!verify(incoming, incomingLength, header)) {
+        return false;
+      }
+      logf("Uploaded program %.*s, %u bytes", header.nameLength, header.name, incomingLength);
+      bool replacing = (program == uploaded);
+      if (replacing && !isRunning()) {
+        unprepare();
+      }
+      uint8_t *swapped = uploaded;
+      uploaded = incoming;
+      incoming = swapped;
+      uploadedLength = incomingLength;
+      uploadReady = true;
+      if (replacing && isRunning()) {
+        // the old program's code is now the next upload's buffer, so swap the running pattern over too
+        gScratch.giveBack(this);
+        gOscillators.release(this);
+        preload();
+        setup();
+      }
+      return true;
+    }
+
+    // Checks a program and fills in header. Logs why and returns false if it can't run.
+    static bool verify(const uint8_t *program, uint16_t length, VMHeader &header) {
+      if (length < 8 || program[0] != VM_MAGIC || program[1] != VM_VERSION) {
+        logf("VM: not a version %u program", VM_VERSION);
+        return false;
+      }
+      header.flags = program[2];
+      header.palette = program[3];
+      header.framerate = program[4] | (program[5] << 8);
+      header.nameLength = program[6];
+      header.name = (const char *)program + 7;
+      uint16_t offset = 7 + header.nameLength;
+      if (header.nameLength > VM_NAME_BYTES || offset >= length) {
+        logf("VM: bad program name");
+        return false;
+      }
+      header.oscillatorCount = program[offset++];
+      header.oscillators = program + offset;
+      offset += 7 * header.oscillatorCount;
+      if (header.oscillatorCount > VM_MAX_OSCILLATORS || offset > length) {
+        logf("VM: bad oscillator list");
+        return false;
+      }
+      for (uint8_t i = 0; i < header.oscillatorCount; ++i) {
+        if (header.oscillators[7 * i] >= oscShapeCount) {
+          logf("VM: unknown oscillator shape");
+          return false;
+        }
+      }
+      header.code = program + offset;
+      header.codeLength = length - offset;
+      return verifyCode(header);
+    }
+
+  private:
+    enum Result : uint8_t {
+      resultNone, resultScalar, resultVector, resultSame, resultEither
+    };
+
+    static bool reject(uint16_t pc, const char *reason) {
+      logf("VM: %s at code offset %u", reason, pc);
+      return false;
+    }
+
+    // Walks the code once with the stack's shape (which slots hold vectors) instead of its values.
+    // Jumps only go forward and must nest, and the stack has to have the same shape on both paths to
+    // where one lands.
+    static bool verifyCode(VMHeader &header) {
+      const uint8_t *code = header.code;
+      uint16_t length = header.codeLength;
+      struct {
+        uint16_t target;
+        uint8_t depth;
+        uint8_t vectors;
+      } jumps[VM_MAX_NESTING];
+      uint8_t open = 0;
+      uint8_t depth = 0;
+      uint8_t vectors = 0; // bit n set when stack slot n holds a vector
+      header.maxVectors = 0;
+
+      uint16_t pc = 0;
+      while (true) {
+        for (; open && jumps[open - 1].target == pc; --open) {
+          if (jumps[open - 1].depth != depth || jumps[open - 1].vectors != vectors) {
+            return reject(pc, "stack differs where a jump lands");
+          }
+        }
+        if (open && jumps[open - 1].target < pc) {
+          return reject(pc, "jump into an instruction");
+        }
+        if (pc == length) {
+          break;
+        }
+        uint8_t op = code[pc];
+        uint8_t operandBytes = operandSize(op);
+        if (pc + 1 + operandBytes > length) {
+          return reject(pc, "truncated instruction");
+        }
+        const uint8_t *operand = code + pc + 1;
+        // how many values the op pops, which of those (bit 0 the top) must be scalars, and what it pushes
+        uint8_t pops = 0;
+        uint8_t scalars = 0;
+        Result result = resultNone;
+        switch (op) {
+          case vmPush8:
+          case vmPush16:
+          case vmMillis:
+          case vmRunTime:
+          case vmPaletteCount:
+            result = resultScalar;
+            break;
+          case vmLoad:
+          case vmStore:
+            if (operand[0] >= VM_REGISTERS) {
+              return reject(pc, "no such register");
+            }
+            pops = scalars = (op == vmStore ? 1 : 0);
+            result = (op == vmLoad ? resultScalar : resultNone);
+            break;
+          case vmOsc:
+            if (operand[0] >= header.oscillatorCount) {
+              return reject(pc, "no such oscillator");
+            }
+            result = resultScalar;
+            break;
+          case vmEvery:
+            if (operand[0] >= VM_TIMERS) {
+              return reject(pc, "no such timer");
+            }
+            result = resultScalar;
+            break;
+          case vmRandom8:
+            pops = scalars = 1;
+            result = resultScalar;
+            break;
+          case vmJumpIfZero:
+            pops = scalars = 1;
+            break;
+          case vmDup:
+            pops = 1;
+            result = resultSame;
+            break;
+          case vmDrop:
+            pops = 1;
+            break;
+          case vmSwap:
+            pops = 2;
+            break;
+          case vmDiv:
+          case vmMod:
+          case vmLess:
+            pops = 2;
+            scalars = 3;
+            result = resultScalar;
+            break;
+          case vmSelect:
+            pops = 3;
+            scalars = 7;
+            result = resultScalar;
+            break;
+          case vmAdd:
+          case vmSub:
+          case vmMul:
+          case vmMulHi:
+          case vmMin:
+          case vmMax:
+          case vmAnd:
+          case vmScale8:
+            pops = 2;
+            result = resultEither;
+            break;
+          case vmShr:
+          case vmShl:
+            // values are at most 32 bits, and shifting those by 32 or more is undefined
+            if (operand[0] >= 32) {
+              return reject(pc, "shift of 32 bits or more");
+            }
+            pops = 1;
+            result = resultSame;
+            break;
+          case vmSin8:
+          case vmSin16:
+          case vmFold:
+          case vmReverse:
+            pops = 1;
+            result = resultSame;
+            break;
+          case vmRamp:
+            pops = 2;
+            scalars = 3;
+            result = resultVector;
+            break;
+          case vmColor:
+          case vmHsv:
+            pops = 3;
+            scalars = 1;
+            break;
+          case vmFade:
+          case vmPalette:
+          case vmPaletteBlend:
+          case vmParticles:
+            pops = scalars = 1;
+            break;
+          case vmSpawn:
+            pops = 2;
+            scalars = 3;
+            break;
+          default:
+            return reject(pc, "unknown op");
+        }
+        if ((op == vmColor || op == vmPalette || op == vmPaletteBlend) && !(header.flags & vmUsesPalette)) {
+          return reject(pc, "palette op without the palette flag");
+        }
+        if ((op == vmSpawn || op == vmParticles) && !(header.flags & vmUsesParticles)) {
+          return reject(pc, "particle op without the particles flag");
+        }
+
+        if (depth < pops) {
+          return reject(pc, "stack underflow");
+        }
+        uint8_t popped = (vectors >> (depth - pops)) & ((1 << pops) - 1); // bit pops - 1 is the top
+        for (uint8_t i = 0; i < pops; ++i) {
+          if ((scalars & (1 << i)) && (popped & (1 << (pops - 1 - i)))) {
+            return reject(pc, "vector where a scalar is needed");
+          }
+        }
+        depth -= pops;
+        vectors &= (1 << depth) - 1;
+
+        uint8_t pushed = 0; // vector bits of what goes back, bottom first
+        uint8_t pushes = 0;
+        switch (result) {
+          case resultNone:
+            break;
+          case resultScalar:
+            pushes = 1;
+            break;
+          case resultVector:
+            pushed = 1;
+            pushes = 1;
+            break;
+          case resultSame:
+            pushed = popped >> (pops - 1);
+            pushes = 1;
+            break;
+          case resultEither:
+            pushed = (popped != 0);
+            pushes = 1;
+            break;
+        }
+        if (op == vmDup) {
+          pushed |= pushed << 1;
+          pushes = 2;
+        } else if (op == vmSwap) {
+          pushed = ((popped & 1) << 1) | (popped >> 1);
+          pushes = 2;
+        } else if (op == vmJumpIfZero) {
+          uint16_t target = pc + 2 + operand[0];
+          if (target > length || open == VM_MAX_NESTING || (open && target > jumps[open - 1].target)) {
+            return reject(pc, "bad jump");
+          }
+          jumps[open].target = target;
+          jumps[open].depth = depth;
+          jumps[open].vectors = vectors;
+          ++open;
+        }
+        if (depth + pushes > VM_STACK_DEPTH) {
+          return reject(pc, "stack overflow");
+        }
+        vectors |= pushed << depth;
+        depth += pushes;
+
+        uint8_t vectorCount = 0;
+        for (uint8_t i = 0; i < depth; ++i) {
+          vectorCount += (vectors >> i) & 1;
+        }
+        if (vectorCount > VM_MAX_VECTORS) {
+          return reject(pc, "too many vectors at once");
+        }
+        header.maxVectors = max(header.maxVectors, vectorCount);
+        pc += 1 + operandBytes;
+      }
+      return true;
+    }
+
+    static uint8_t operandSize(uint8_t op) {
+      switch (op) {
+        case vmPush8:
+        case vmLoad:
+        case vmStore:
+        case vmOsc:
+        case vmJumpIfZero:
+        case vmShr:
+        case vmShl:
+          return 1;
+        case vmPush16:
+          return 2;
+        case vmEvery:
+          return 3;
+        default:
+          return 0;
+      }
+    }
+  public:
+    // only draws as often as the program asks
+    uint16_t motionFramerate() {
+      return programFramerate;
+    }
+
+    const char *description() {
+      return name;
+    }
+
+  private:
+    // Parses a program into what the interpreter uses, borrows its scratch and adds its oscillators
+    bool load(const uint8_t *program, uint16_t length) {
+      VMHeader header;
+      if (!verify(program, length, header)) {
+        return false;
+      }
+      snprintf(name, sizeof(name), "VM %.*s", header.nameLength, header.name);
+      flags = header.flags;
+      programFramerate = (header.framerate ? header.framerate : MAX_FRAMERATE);
+      vectorCount = header.maxVectors;
+      if (vectorCount) {
+        vectors = borrowScratch<uint16_t>(vectorCount * NUM_LEDS);
+        if (!vectors) {
+          return false;
+        }
+      }
+      if (flags & vmUsesPalette) {
+        currentPalette = borrowScratch<CRGBPalette16>();
+        targetPalette = borrowScratch<CRGBPalette16>();
+        if (!currentPalette || !targetPalette) {
+          return false;
+        }
+      }
+      if (flags & vmUsesParticles) {
+        particles = borrowScratch<VMParticle>(VM_PARTICLES);
+        if (!particles) {
+          return false;
+        }
+      }
+      memset(registers, 0, sizeof(registers));
+      if (flags & vmUsesPalette) {
+        registers[0] = (header.palette == 0xFF ? random16(gGradientPaletteCount) : header.palette % gGradientPaletteCount);
+        loadGradientPalette(*targetPalette, registers[0]);
+      }
+      for (uint8_t i = 0; i < header.oscillatorCount; ++i) {
+        const uint8_t *spec = header.oscillators + 7 * i;
+        oscillators[i] = addOscillator((OscShape)spec[0], (int16_t)(spec[1] | (spec[2] << 8)),
+                                       spec[3] | (spec[4] << 8), spec[5] | (spec[6] << 8));
+      }
+      this->program = program;
+      code = header.code;
+      codeLength = header.codeLength;
+      return true;
+    }
+
+    void preload() {
+      program = NULL;
+      code = NULL;
+      vectors = NULL;
+      currentPalette = NULL;
+      targetPalette = NULL;
+      particles = NULL;
+      if (uploadReady && (variant == -1 || variant == programCount)) {
+        load(uploaded, uploadedLength);
+      } else if (programCount) {
+        // no dice for a single program, so it draws from the same RNG state a native pattern would
+        uint8_t n = (variant >= 0 && variant < programCount ? variant : programCount > 1 ? random8(programCount) : 0);
+        load(programs[n]->data, programs[n]->length);
+      }
+    }
+
+    void setup() {
+      uint32_t now = gClock.millis();
+      for (uint8_t i = 0; i < VM_TIMERS; ++i) {
+        timers[i] = now;
+      }
+      particleMillis = now;
+    }
+
+    void scratchReturned() {
+      program = NULL;
+      code = NULL;
+      vectors = NULL;
+      currentPalette = NULL;
+      targetPalette = NULL;
+      particles = NULL;
+    }
+
+    void update(CRGBArray<NUM_LEDS> &leds) {
+      if (!code) {
+        return;
+      }
+      depth = 0;
+      freeVectors = (1 << vectorCount) - 1;
+      const uint8_t *pc = code;
+      const uint8_t *end = code + codeLength;
+      while (pc < end) {
+        switch (*pc++) {
+          case vmPush8:
+            push(*pc++);
+            break;
+          case vmPush16:
+            push((int16_t)(pc[0] | (pc[1] << 8)));
+            pc += 2;
+            break;
+          case vmLoad:
+            push(registers[*pc++]);
+            break;
+          case vmStore:
+            registers[*pc++] = pop();
+            break;
+          case vmOsc:
+            push(oscillator(oscillators[*pc++]));
+            break;
+          case vmMillis:
+            push(gClock.millis());
+            break;
+          case vmRunTime:
+            push(runTime());
+            break;
+          case vmRandom8:
+            top().scalar = random8(top().scalar);
+            break;
+          case vmEvery: {
+            uint32_t now = gClock.millis();
+            uint32_t &last = timers[pc[0]];
+            bool ready = (now - last >= (uint16_t)(pc[1] | (pc[2] << 8)));
+            if (ready) {
+              last = now;
+            }
+            push(ready);
+            pc += 3;
+            break;
+          }
+          case vmJumpIfZero: {
+            uint8_t offset = *pc++;
+            if (!pop()) {
+              pc += offset;
+            }
+            break;
+          }
+          case vmDup: {
+            Slot &slot = top();
+            if (slot.lanes) {
+              uint16_t *copy = takeLanes();
+              memcpy(copy, slot.lanes, NUM_LEDS * sizeof(uint16_t));
+              stack[depth].lanes = copy;
+              ++depth;
+            } else {
+              push(slot.scalar);
+            }
+            break;
+          }
+          case vmDrop:
+            releaseLanes(stack[--depth]);
+            break;
+          case vmSwap: {
+            Slot swapped = stack[depth - 1];
+            stack[depth - 1] = stack[depth - 2];
+            stack[depth - 2] = swapped;
+            break;
+          }
+          case vmDiv: {
+            int32_t b = pop();
+            int32_t a = top().scalar;
+            top().scalar = (b == 0 ? 0 : b == -1 ? 0u - (uint32_t)a : a / b);
+            break;
+          }
+          case vmMod: {
+            int32_t b = pop();
+            int32_t a = top().scalar;
+            top().scalar = (b == 0 || b == -1 ? 0 : a % b);
+            break;
+          }
+          case vmLess: {
+            int32_t b = pop();
+            top().scalar = ((int32_t)top().scalar < b);
+            break;
+          }
+          case vmSelect: {
+            uint32_t condition = pop();
+            uint32_t b = pop();
+            if (!condition) {
+              top().scalar = b;
+            }
+            break;
+          }
+          case vmPaletteCount:
+            push(gGradientPaletteCount);
+            break;
+
+          case vmAdd:
+            binary([](uint32_t a, uint32_t b) { return a + b; });
+            break;
+          case vmSub:
+            binary([](uint32_t a, uint32_t b) { return a - b; });
+            break;
+          case vmMul:
+            binary([](uint32_t a, uint32_t b) { return a * b; });
+            break;
+          case vmMulHi:
+            binary([](uint32_t a, uint32_t b) { return ((a & 0xFFFF) * (b & 0xFFFF)) >> 16; });
+            break;
+          case vmMin:
+            binary([](uint32_t a, uint32_t b) { return a < b ? a : b; });
+            break;
+          case vmMax:
+            binary([](uint32_t a, uint32_t b) { return a > b ? a : b; });
+            break;
+          case vmAnd:
+            binary([](uint32_t a, uint32_t b) { return a & b; });
+            break;
+          case vmScale8:
+            binary([](uint32_t a, uint32_t b) { return (uint32_t)scale8(a, b); });
+            break;
+          case vmShr: {
+            uint8_t bits = *pc++;
+            unary([bits](uint32_t a) { return a >> bits; });
+            break;
+          }
+          case vmShl: {
+            uint8_t bits = *pc++;
+            unary([bits](uint32_t a) { return a << bits; });
+            break;
+          }
+          case vmSin8:
+            unary([](uint32_t a) { return (uint32_t)sin8(a); });
+            break;
+          case vmSin16:
+            unary([](uint32_t a) { return (uint32_t)(uint16_t)(sin16(a) + 32768); });
+            break;
+          case vmFold:
+            unary([](uint32_t a) { return (uint32_t)((uint16_t)(a & 0x8000 ? ~a : a) >> 8); });
+            break;
+
+          case vmRamp: {
+            uint32_t step = pop();
+            uint32_t base = pop();
+            uint16_t *lanes = takeLanes();
+            for (uint8_t i = 0; i < NUM_LEDS; ++i) {
+              lanes[i] = base + i * step;
+            }
+            stack[depth].lanes = lanes;
+            ++depth;
+            break;
+          }
+          case vmReverse: {
+            uint16_t *lanes = top().lanes;
+            if (lanes) {
+              for (uint8_t i = 0; i < NUM_LEDS / 2; ++i) {
+                uint16_t swapped = lanes[i];
+                lanes[i] = lanes[NUM_LEDS - 1 - i];
+                lanes[NUM_LEDS - 1 - i] = swapped;
+              }
+            }
+            break;
+          }
+
+          case vmColor:
+            blendOver(leds, [this](uint8_t index, uint8_t level) { return ColorFromPalette(*currentPalette, index, level); });
+            break;
+          case vmHsv:
+            blendOver(leds, [](uint8_t hue, uint8_t level) { return gHueRing.rgb(hue, 255, level); });
+            break;
+          case vmFade:
+            leds.fadeToBlackBy(pop());
+            break;
+          case vmPalette:
+            loadGradientPalette(*targetPalette, pop() % gGradientPaletteCount);
+            break;
+          case vmPaletteBlend:
+            nblendPaletteTowardPalette(*currentPalette, *targetPalette, pop());
+            break;
+          case vmSpawn: {
+            int32_t speed = pop();
+            spawn(pop(), speed);
+            break;
+          }
+          case vmParticles:
+            drawParticles(leds, pop());
+            break;
+        }
+      }
+    }
+
+    void push(uint32_t value) {
+      stack[depth].scalar = value;
+      stack[depth].lanes = NULL;
+      ++depth;
+    }
+
+    uint32_t pop() {
+      return stack[--depth].scalar;
+    }
+
+    Slot &top() {
+      return stack[depth - 1];
+    }
+
+    // the verifier has made sure there is always one free
+    uint16_t *takeLanes() {
+      uint8_t i = 0;
+      while (!(freeVectors & (1 << i))) {
+        ++i;
+      }
+      freeVectors &= ~(1 << i);
+      return vectors + i * NUM_LEDS;
+    }
+
+    void releaseLanes(const Slot &slot) {
+      if (slot.lanes) {
+        freeVectors |= 1 << ((slot.lanes - vectors) / NUM_LEDS);
+      }
+    }
+
+    static uint16_t lane(const Slot &slot, uint8_t i) {
+      return slot.lanes ? slot.lanes[i] : slot.scalar;
+    }
+
+    // The kernels: one loop over the lanes per op. A scalar operand counts as its low 16 bits in every lane.
+    template<typename F>
+    void binary(F f) {
+      Slot b = stack[--depth];
+      Slot &a = top();
+      if (a.lanes && b.lanes) {
+        for (uint8_t i = 0; i < NUM_LEDS; ++i) {
+          a.lanes[i] = f(a.lanes[i], b.lanes[i]);
+        }
+        releaseLanes(b);
+      } else if (a.lanes) {
+        uint16_t scalar = b.scalar;
+        for (uint8_t i = 0; i < NUM_LEDS; ++i) {
+          a.lanes[i] = f(a.lanes[i], scalar);
+        }
+      } else if (b.lanes) {
+        uint16_t scalar = a.scalar;
+        for (uint8_t i = 0; i < NUM_LEDS; ++i) {
+          b.lanes[i] = f(scalar, b.lanes[i]);
+        }
+        a = b;
+      } else {
+        a.scalar = f(a.scalar, b.scalar);
+      }
+    }
+
+    template<typename F>
+    void unary(F f) {
+      Slot &a = top();
+      if (a.lanes) {
+        for (uint8_t i = 0; i < NUM_LEDS; ++i) {
+          a.lanes[i] = f(a.lanes[i]);
+        }
+      } else {
+        a.scalar = f(a.scalar);
+      }
+    }
+
+    // index level mix: nblend()s color(index, level) over every led
+    template<typename F>
+    void blendOver(CRGBArray<NUM_LEDS> &leds, F color) {
+      uint8_t mix = pop();
+      Slot level = stack[--depth];
+      Slot index = stack[--depth];
+      for (uint8_t i = 0; i < NUM_LEDS; ++i) {
+        nblend(leds[i], color(lane(index, i), lane(level, i)), mix);
+      }
+      releaseLanes(level);
+      releaseLanes(index);
+    }
+
+    void spawn(uint8_t index, int32_t speed) {
+      for (uint8_t i = 0; i < VM_PARTICLES; ++i) {
+        VMParticle &particle = particles[i];
+        if (!particle.alive) {
+          particle.alive = true;
+          particle.position = random16(NUM_LEDS) << 8;
+          particle.birth = gClock.millis();
+          particle.speed = constrain(speed, -128, 127);
+          particle.index = index;
+          return;
+        }
+      }
+    }
+
+    // Particles wrap around the ends, and fade up then down again over their lifespan
+    void drawParticles(CRGBArray<NUM_LEDS> &leds, uint32_t lifespan) {
+      uint32_t now = gClock.millis();
+      int32_t elapsed = now - particleMillis;
+      particleMillis = now;
+      lifespan = constrain(lifespan, 2u, 0xFFFFu);
+      uint16_t half = lifespan / 2;
+      for (uint8_t i = 0; i < VM_PARTICLES; ++i) {
+        VMParticle &particle = particles[i];
+        if (!particle.alive) {
+          continue;
+        }
+        uint16_t age = (uint16_t)now - particle.birth;
+        if (age >= lifespan) {
+          particle.alive = false;
+          continue;
+        }
+        int32_t position = (particle.position + particle.speed * elapsed * 256 / 1000) % (NUM_LEDS << 8);
+        particle.position = (position < 0 ? position + (NUM_LEDS << 8) : position);
+        uint8_t level = min(255u, 255u * (age < half ? age : lifespan - age) / half);
+        CRGB color = (flags & vmUsesPalette) ? ColorFromPalette(*currentPalette, particle.index, level)
+                                             : gHueRing.rgb(particle.index, 255, level);
+        leds[particle.position >> 8] += color;
+      }
+    }
+};
+
+// The VM port of SmoothPalettes (programs.vm) against the native pattern. Both run in lockstep on a
+// virtual clock from the same seed, each with its own RNG state, so their frames can be compared as well as
+// their cycles. The cycles go out as "cycles" lines for bench_report.py, followed by the ratio.
+void benchmarkVMPort(CRGBArray<NUM_LEDS> &leds) {
+  const unsigned int kFrames = 2000;
+  const uint16_t kFrameMillis = 5;
+
+  SmoothPalettes native;
+  const VMProgram *port[] = {&vmSmoothPalettes};
+  VMPattern vm(port, 1);
+  CRGBArray<NUM_LEDS> vmLeds;
+  Pattern *patterns[2] = {&native, &vm};
+  CRGBArray<NUM_LEDS> *frames[2] = {&leds, &vmLeds};
+  const char *names[2] = {"Smooth palettes (native)", "Smooth palettes (VM)"};
+  uint16_t seeds[2];
+  uint64_t total[2] = {0};
+  uint32_t most[2] = {0};
+  long firstDifference = -1;
+
+  CycleCounter::begin();
+  gClock.useVirtualTime(1000);
+  for (uint8_t side = 0; side < 2; ++side) {
+    frames[side]->fill_solid(CRGB::Black);
+    random16_set_seed(1337);
+    patterns[side]->start();
+    seeds[side] = random16_get_seed();
+  }
+  for (unsigned int frame = 0; frame < kFrames; ++frame) {
+    for (uint8_t side = 0; side < 2; ++side) {
+      random16_set_seed(seeds[side]);
+      uint32_t start = CycleCounter::now();
+      patterns[side]->loop(*frames[side]);
+      uint32_t cycles = CycleCounter::now() - start;
+      seeds[side] = random16_get_seed();
+      total[side] += cycles;
+      most[side] = max(most[side], cycles);
+    }
+    if (firstDifference == -1 && memcmp(&leds[0], &vmLeds[0], NUM_LEDS * sizeof(CRGB)) != 0) {
+      firstDifference = frame;
+    }
+    gClock.advance(kFrameMillis);
+  }
+  uint32_t budget = F_CPU / native.framerate();
+  for (uint8_t side = 0; side < 2; ++side) {
+    patterns[side]->stop();
+    logf("cycles %lu avg %lu max %lu budget %s", (unsigned long)(total[side] / kFrames), (unsigned long)most[side], (unsigned long)budget, names[side]);
+  }
+  logf("VM port of Smooth palettes: %.2fx native cycles, frames %s", (float)total[1] / total[0],
+       firstDifference == -1 ? "identical" : "differ");
+  if (firstDifference != -1) {
+    logf("  first differing frame %ld", firstDifference);
+  }
+  gClock.useRealTime();
+  leds.fill_solid(CRGB::Black);
+}
+
+#endif
@@ -0,0 +1,223 @@
+#!/usr/bin/env python3
+# Assembler for the pattern bytecode in vm.h.
+#
+#   ./vm_asm.py [programs.vm] [vm_programs.h]         rebuild the programs compiled into the firmware
+#   ./vm_asm.py --load /dev/ttyACM0 embers            upload one over the control protocol and start it
+#   ./vm_asm.py --dump embers                         show the bytes of one
+#
+# The source format is described at the top of programs.vm. The pendant verifies a program before running
+# it (stack depth, scalar and vector operands, jumps) and logs why if it won't; this only checks syntax.
+import argparse
+import os
+import re
+import shlex
+import struct
+
+from control import FrameReader, open_port, request
+
+LOAD_PROGRAM = 0x09
+CHUNK_FIRST = 0x01
+CHUNK_LAST = 0x02
+CHUNK_BYTES = 63
+MAGIC = ord("V")
+VERSION = 1
+NAME_BYTES = 23
+FLAG_PALETTE = 0x01
+FLAG_PARTICLES = 0x02
+SHAPES = {"sine": 0, "sine8": 1, "triangle": 2, "saw": 3}
+
+# name: (opcode, operand struct format)
+OPS = {
+	"push8": (0x01, "<B"),
+	"push16": (0x02, "<h"),
+	"load": (0x03, "<B"),
+	"store": (0x04, "<B"),
+	"osc": (0x05, "<B"),
+	"millis": (0x06, ""),
+	"runtime": (0x07, ""),
+	"random8": (0x08, ""),
+	"every": (0x09, "<BH"),
+	"jz": (0x0A, "label"),
+	"dup": (0x0B, ""),
+	"drop": (0x0C, ""),
+	"swap": (0x0D, ""),
+	"div": (0x0E, ""),
+	"mod": (0x0F, ""),
+	"less": (0x10, ""),
+	"select": (0x11, ""),
+	"palettecount": (0x12, ""),
+	"add": (0x20, ""),
+	"sub": (0x21, ""),
+	"mul": (0x22, ""),
+	"mulhi": (0x23, ""),
+	"min": (0x24, ""),
+	"max": (0x25, ""),
+	"and": (0x26, ""),
+	"scale8": (0x27, ""),
+	"shr": (0x28, "<B"),
+	"shl": (0x29, "<B"),
+	"sin8": (0x2A, ""),
+	"sin16": (0x2B, ""),
+	"fold": (0x2C, ""),
+	"ramp": (0x30, ""),
+	"reverse": (0x31, ""),
+	"color": (0x40, ""),
+	"hsv": (0x41, ""),
+	"fade": (0x42, ""),
+	"palette": (0x43, ""),
+	"paletteblend": (0x44, ""),
+	"spawn": (0x45, ""),
+	"particles": (0x46, ""),
+}
+
+class Program:
+	def __init__(self, ident, name):
+		self.ident = ident
+		self.name = name
+		self.framerate = 0
+		self.palette = None
+		self.particles = False
+		self.oscillators = []
+		self.lines = []
+
+	def assemble(self):
+		flags = (FLAG_PALETTE if self.palette is not None else 0) | (FLAG_PARTICLES if self.particles else 0)
+		name = self.name.encode("ascii")
+		if len(name) > NAME_BYTES:
+			raise SystemExit("{}: name longer than {} bytes".format(self.ident, NAME_BYTES))
+		header = struct.pack("<BBBBHB", MAGIC, VERSION, flags, 0xFF if self.palette in (None, "random") else self.palette,
+			self.framerate, len(name)) + name + struct.pack("<B", len(self.oscillators))
+		for shape, bpm88, low, high in self.oscillators:
+			header += struct.pack("<BhHH", shape, bpm88, low, high)
+
+		# every instruction's size is fixed, so one pass finds the labels and a second encodes
+		labels = {}
+		address = 0
+		for line, op, args in self.lines:
+			if op.endswith(":"):
+				labels[op[:-1]] = address
+			else:
+				address += 1 + (1 if OPS[op][1] == "label" else struct.calcsize(OPS[op][1]))
+		code = b""
+		for line, op, args in self.lines:
+			if op.endswith(":"):
+				continue
+			opcode, operands = OPS[op]
+			if operands == "label":
+				if len(args) != 1 or args[0] not in labels:
+					raise SystemExit("{} line {}: jz needs a label".format(self.ident, line))
+				offset = labels[args[0]] - (len(code) + 2)
+				if not 0 <= offset <= 255:
+					raise SystemExit("{} line {}: jz can only jump up to 255 bytes forward".format(self.ident, line))
+				code += struct.pack("<BB", opcode, offset)
+				continue
+			count = len(operands) - 1 if operands else 0
+			if len(args) != count:
+				raise SystemExit("{} line {}: {} takes {} operand(s)".format(self.ident, line, op, count))
+			try:
+				code += struct.pack("<B", opcode) + (struct.pack(operands, *(int(a, 0) for a in args)) if count else b"")
+			except (ValueError, struct.error) as error:
+				raise SystemExit("{} line {}: {}".format(self.ident, line, error))
+		return header + code
+
+def parse(path):
+	programs = []
+	program = None
+	for number, text in enumerate(open(path), 1):
+		words = shlex.split(text.split(";")[0])
+		if not words:
+			continue
+		keyword, args = words[0].lower(), words[1:]
+		if keyword == "program":
+			program = Program(args[0], args[1] if len(args) > 1 else args[0])
+			programs.append(program)
+			continue
+		if program is None:
+			raise SystemExit("line {}: code before the first program".format(number))
+		# directives come before the code; after it, palette and particles are the ops of the same name
+		if program.lines or keyword not in ("framerate", "palette", "particles", "osc"):
+			if not (keyword.endswith(":") or keyword in OPS):
+				raise SystemExit("line {}: unknown op {}".format(number, keyword))
+			program.lines.append((number, words[0] if keyword.endswith(":") else keyword, args))
+		elif keyword == "framerate":
+			program.framerate = int(args[0])
+		elif keyword == "palette":
+			program.palette = "random" if args[0] == "random" else int(args[0])
+		elif keyword == "particles":
+			program.particles = True
+		else:
+			if args[0] not in SHAPES:
+				raise SystemExit("line {}: unknown oscillator shape {}".format(number, args[0]))
+			program.oscillators.append((SHAPES[args[0]],) + tuple(int(a, 0) for a in args[1:4]))
+	return programs
+
+def c_name(ident):
+	return "vm" + "".join(part.capitalize() for part in re.split(r"[_\W]+", ident) if part)
+
+def byte_rows(values, per_row):
+	rows = []
+	for i in range(0, len(values), per_row):
+		rows.append("  " + ", ".join("{:3}".format(v) for v in values[i:i + per_row]) + ",")
+	return "\n".join(rows)
+
+def write_header(programs, src_path, dst_path):
+	assembled = [(program, program.assemble()) for program in programs]
+	with open(dst_path, "w") as out:
+		out.write("// Generated by vm_asm.py from {} -- do not edit.\n".format(os.path.basename(src_path)))
+		out.write("//\n")
+		out.write("// {} programs, {} bytes of PROGMEM.\n".format(len(programs), sum(len(data) for _, data in assembled)))
+		out.write("\n#ifndef VM_PROGRAMS_H\n#define VM_PROGRAMS_H\n")
+		for program, data in assembled:
+			name = c_name(program.ident)
+			out.write("\n// {} ({} bytes)\n".format(program.name, len(data)))
+			out.write("const uint8_t {}Data[] PROGMEM = {{\n".format(name))
+			out.write(byte_rows(data, 16))
+			out.write("\n};\n")
+			out.write("const VMProgram {0} = {{{0}Data, sizeof({0}Data)}};\n".format(name))
+		out.write("\n#endif\n")
+	for program, data in assembled:
+		print("{:<20} {:4} bytes".format(program.ident, len(data)))
+
+def find(programs, ident):
+	for program in programs:
+		if program.ident == ident:
+			return program
+	raise SystemExit("no program {}".format(ident))
+
+def upload(port, baud, verbose, data):
+	fd = open_port(port, baud)
+	reader = FrameReader(fd, verbose)
+	for offset in range(0, len(data), CHUNK_BYTES):
+		chunk = data[offset:offset + CHUNK_BYTES]
+		flags = (CHUNK_FIRST if offset == 0 else 0) | (CHUNK_LAST if offset + CHUNK_BYTES >= len(data) else 0)
+		request(fd, reader, LOAD_PROGRAM, bytes([flags]) + chunk)
+	print("uploaded {} bytes".format(len(data)))
+
+def main():
+	os.chdir(os.path.dirname(os.path.realpath(__file__)))
+	parser = argparse.ArgumentParser()
+	parser.add_argument("source", nargs="?", default="programs.vm")
+	parser.add_argument("header", nargs="?", default="vm_programs.h")
+	parser.add_argument("--load", metavar="PORT", help="Upload --program (or the first one) to a pendant")
+	parser.add_argument("--dump", action="store_true", help="Print the bytes of --program instead of writing the header")
+	parser.add_argument("--program", help="Program id for --load and --dump")
+	parser.add_argument("--baud", type=int, default=57600)
+	parser.add_argument("-v", dest="verbose", action="store_true", help="Show log text from the pendant")
+	args = parser.parse_args()
+
+	# "./vm_asm.py --load PORT embers": a lone argument that isn't a file names the program
+	if (args.load or args.dump) and args.program is None and args.source != "programs.vm" and not os.path.exists(args.source):
+		args.program, args.source = args.source, "programs.vm"
+	programs = parse(args.source)
+	if args.load or args.dump:
+		program = find(programs, args.program) if args.program else programs[0]
+		data = program.assemble()
+		if args.dump:
+			print(" ".join("{:02x}".format(b) for b in data))
+		else:
+			upload(args.load, args.baud, args.verbose, data)
+		return
+	write_header(programs, args.source, args.header)
+
+if __name__ == "__main__":
+	main()
@@ -0,0 +1,34 @@
+// Generated by vm_asm.py from programs.vm -- do not edit.
+//
+// 2 programs, 238 bytes of PROGMEM.
+
+#ifndef VM_PROGRAMS_H
+#define VM_PROGRAMS_H
+
+// Smooth palettes (164 bytes)
+const uint8_t vmSmoothPalettesData[] PROGMEM = {
+   86,   1,   1, 255,  50,   0,  15,  83, 109, 111, 111, 116, 104,  32, 112,  97,
+  108, 101, 116, 116, 101, 115,   5,   0,  85,   1,  96,   0, 224,   0,   0, 203,
+    0,   0,  25,   0,  40,   0, 147,   0,  23,   0,  60,   0,   0, 113,   0,  44,
+    1, 220,   5,   0, 144,   1,   5,   0,   9,   0,   9,   0,  20,   0,  10, 100,
+    9,   1,  32,  78,  10,  12,   3,   0,   1,  16,   8,  32,  18,  15,  11,   4,
+    0,  67,   9,   2,  40,   0,  10,   3,   1,  16,  68,   3,   1,   5,   3,  32,
+    5,   3,  48,  44,   1, 240,  39,  49,   6,  11,   3,   2,  33,  13,   4,   2,
+   11,   5,   2,  34,   3,   3,  32,   4,   3,   5,   4,  34,   3,   1,  32,   4,
+    1,   3,   3,   5,   1,  32,   5,   1,  48,  43,  11,  35,   5,   0,  35,   2,
+  255,   0,   5,   0,  33,  32,  49,   7,   1,  15,  14,   1, 128,   7,   2, 208,
+    7,  16,  17,  64,
+};
+const VMProgram vmSmoothPalettes = {vmSmoothPalettesData, sizeof(vmSmoothPalettesData)};
+
+// Embers (74 bytes)
+const uint8_t vmEmbersData[] PROGMEM = {
+   86,   1,   2, 255,  60,   0,   6,  69, 109,  98, 101, 114, 115,   2,   3,   0,
+    1,   0,   0, 255,   0,   0,   0,   7,  24,   0,  72,   0,   9,   0,  16,   0,
+   10,  40,   1,  24,  66,   5,   0,   6,  40,   3,   1,  11,  48,  42,   5,   1,
+   39,   1,  96,  65,   9,   1, 144,   1,  10,  12,   5,   0,   1, 128,  32,   1,
+   40,   8,   1,  20,  33,  69,   2, 196,   9,  70,
+};
+const VMProgram vmEmbers = {vmEmbersData, sizeof(vmEmbersData)};
+
+#endif